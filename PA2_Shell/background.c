@@ -3,61 +3,331 @@
 // This file implements background process management for the shell.
 // It maintains a linked list of background processes and provides functions
 // to add new background processes, check for terminated processes, and clean them up.
+//
+// When output spooling is enabled (the spool built-in), each background job writes
+// its stdout and stderr into private spool files instead of the shared terminal.
+// A spool is a memfd (or an unlinked file in GUSH_SPOOL_DIR, to keep large outputs
+// out of memory) and is copied to the shell's stdout/stderr in a single write once
+// the job finishes, so output from concurrent jobs never interleaves.
+//
+// Coprocesses (the coproc built-in) are long-lived background processes connected
+// to the shell by two pipes. They live in the same list. When one is reaped its
+// input is closed, but the entry and its output pipe are kept until everything
+// it wrote has been read with "<&NAME" (or it is released with "coproc NAME").
+
+#define _GNU_SOURCE  // Needed for memfd_create()
 
 #include "background.h"
+#include "trace.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 static BackgroundProcess *head = NULL; // Head pointer for the linked list of background processes
+static int spool_mode = SPOOL_OFF;     // Output mode for new background jobs
+static unsigned long next_seq = 0;     // Launch counter for spooled jobs
+static int exit_handler = 0;           // finish_spooled_jobs() is registered
+static unsigned long launched = 0;     // Background processes started so far
 
 // add_background_process - Adds a new process to the background process list.
-void add_background_process(pid_t pid) {
+// out_spool and err_spool are the job's spool files, or -1 if its output is not spooled.
+void add_background_process(pid_t pid, int out_spool, int err_spool) {
     BackgroundProcess *new_process = (BackgroundProcess *)malloc(sizeof(BackgroundProcess));
     if (!new_process) {
         perror("malloc failed");  // Print error if memory allocation fails
         return;
     }
     new_process->pid = pid;
+    new_process->start = trace_now();
+    new_process->out_spool = out_spool;
+    new_process->err_spool = err_spool;
+    new_process->seq = next_seq++;
+    new_process->finished = 0;
+    new_process->coproc_name = NULL;
+    new_process->coproc_in = -1;
+    new_process->coproc_out = -1;
     new_process->next = head; // Insert at the beginning of the list
     head = new_process;
+    launched++;
+}
+
+// background_launches - Returns how many background processes have been started.
+unsigned long background_launches() {
+    return launched;
+}
+
+// create_spool - Creates one empty spool file.
+static int create_spool() {
+    const char *dir = getenv("GUSH_SPOOL_DIR");
+    int fd = -1;
+
+    if (dir != NULL && *dir != '\0') {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/gush-spool-XXXXXX", dir);
+        fd = mkstemp(path);
+        if (fd >= 0) {
+            unlink(path);  // Only the descriptors keep it alive
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        return fd;
+    }
+#ifdef __linux__
+    fd = memfd_create("gush-spool", MFD_CLOEXEC);
+#else
+    char path[] = "/tmp/gush-spool-XXXXXX";
+    fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    return fd;
+}
+
+// open_spools - Creates the stdout and stderr spools for a new background job.
+// Sets both to -1 when spooling is off. Returns -1 if a spool cannot be created.
+int open_spools(int *out_spool, int *err_spool) {
+    *out_spool = -1;
+    *err_spool = -1;
+    if (spool_mode == SPOOL_OFF) {
+        return 0;
+    }
+    *out_spool = create_spool();
+    *err_spool = create_spool();
+    if (*out_spool < 0 || *err_spool < 0) {
+        if (*out_spool >= 0) {
+            close(*out_spool);
+        }
+        if (*err_spool >= 0) {
+            close(*err_spool);
+        }
+        *out_spool = -1;
+        *err_spool = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// flush_spool - Copies a spool to target in one write and closes it.
+static void flush_spool(int spool, int target) {
+    struct stat st;
+    if (fstat(spool, &st) == 0 && st.st_size > 0) {
+        char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, spool, 0);
+        if (data != MAP_FAILED) {
+            write_all(target, data, st.st_size);
+            munmap(data, st.st_size);
+        }
+    }
+    close(spool);
+}
+
+// remove_entry - Unlinks an entry from the list and frees it.
+static void remove_entry(BackgroundProcess *entry) {
+    BackgroundProcess **link = &head;
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (*link == NULL) {
+        return;
+    }
+    *link = entry->next;
+    trace_span("process", entry->start, entry->pid, -1);
+    if (entry->coproc_name) {
+        // Close the shell's ends of the coprocess's pipes
+        if (entry->coproc_in >= 0) {
+            close(entry->coproc_in);
+        }
+        close(entry->coproc_out);
+        free(entry->coproc_name);
+    }
+    free(entry);  // Free the memory allocated for the process entry
+}
+
+// flush_job - Writes out a finished job's spools and removes it from the list.
+static void flush_job(BackgroundProcess *job) {
+    fflush(stdout);  // Keep the shell's own messages in order with the spool
+    flush_spool(job->out_spool, STDOUT_FILENO);
+    flush_spool(job->err_spool, STDERR_FILENO);
+    printf("[Background process %d terminated]\n", job->pid);
+    remove_entry(job);
+}
+
+// oldest_spooled_job - Returns the earliest launched job that is still spooling.
+static BackgroundProcess *oldest_spooled_job() {
+    BackgroundProcess *oldest = NULL;
+    for (BackgroundProcess *curr = head; curr; curr = curr->next) {
+        if (curr->out_spool >= 0 && (oldest == NULL || curr->seq < oldest->seq)) {
+            oldest = curr;
+        }
+    }
+    return oldest;
+}
+
+// flush_finished_jobs - Flushes finished jobs: all of them, or in SPOOL_ORDERED mode
+// only those with no unfinished job launched before them.
+static void flush_finished_jobs() {
+    if (spool_mode == SPOOL_ORDERED) {
+        BackgroundProcess *job;
+        while ((job = oldest_spooled_job()) != NULL && job->finished) {
+            flush_job(job);
+        }
+        return;
+    }
+    BackgroundProcess *curr = head;
+    while (curr) {
+        BackgroundProcess *next = curr->next;
+        if (curr->finished && curr->out_spool >= 0) {
+            flush_job(curr);
+        }
+        curr = next;
+    }
+}
+
+// finish_spooled_jobs - Waits for the remaining spooled jobs when the shell exits,
+// so their output is not lost.
+static void finish_spooled_jobs() {
+    BackgroundProcess *job;
+    while ((job = oldest_spooled_job()) != NULL) {
+        if (!job->finished) {
+            waitpid(job->pid, NULL, 0);
+        }
+        flush_job(job);
+    }
+    fflush(stdout);
+}
+
+// set_spool_mode - Selects the output mode for background jobs started from now on.
+void set_spool_mode(int mode) {
+    spool_mode = mode;
+    if (mode != SPOOL_OFF && !exit_handler) {
+        exit_handler = 1;
+        atexit(finish_spooled_jobs);
+    }
+}
+
+// get_spool_mode - Returns the current output mode for background jobs.
+int get_spool_mode() {
+    return spool_mode;
+}
+
+// add_coproc - Adds a coprocess to the background process list.
+// in_fd and out_fd are the shell's ends of the pipes to its stdin and from its stdout.
+void add_coproc(pid_t pid, const char *name, int in_fd, int out_fd) {
+    add_background_process(pid, -1, -1);
+    if (head == NULL || head->pid != pid) {
+        return;  // Allocation failed
+    }
+    head->coproc_name = strdup(name);
+    head->coproc_in = in_fd;
+    head->coproc_out = out_fd;
+}
+
+// find_coproc - Returns the running coprocess with the given name, or NULL.
+BackgroundProcess *find_coproc(const char *name) {
+    for (BackgroundProcess *curr = head; curr; curr = curr->next) {
+        if (curr->coproc_name && strcmp(curr->coproc_name, name) == 0) {
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+// coproc_fd - Returns the descriptor for ">&NAME" (output = 1, the coprocess's
+// stdin) or "<&NAME" (output = 0, its stdout), or -1 if there is none.
+int coproc_fd(const char *name, int output) {
+    BackgroundProcess *coproc = find_coproc(name);
+    if (coproc == NULL) {
+        return -1;
+    }
+    return output ? coproc->coproc_in : coproc->coproc_out;
+}
+
+// list_coprocs - Prints the name and process ID of every coprocess.
+void list_coprocs() {
+    for (BackgroundProcess *curr = head; curr; curr = curr->next) {
+        if (curr->coproc_name) {
+            printf("%s %d%s\n", curr->coproc_name, curr->pid,
+                   curr->finished ? " (exited)" : curr->coproc_in < 0 ? " (input closed)" : "");
+        }
+    }
+}
+
+// release_coproc - Removes a coprocess that has exited, discarding any output
+// that was not read.
+void release_coproc(BackgroundProcess *coproc) {
+    remove_entry(coproc);
+}
+
+// release_drained_coprocs - Removes exited coprocesses whose output has all been read.
+static void release_drained_coprocs() {
+    BackgroundProcess *curr = head;
+    while (curr) {
+        BackgroundProcess *next = curr->next;
+        if (curr->coproc_name && curr->finished) {
+            struct pollfd pfd = {curr->coproc_out, POLLIN, 0};
+            // Drained once the pipe is at end of file with nothing left in it
+            if (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLHUP) && !(pfd.revents & POLLIN)) {
+                remove_entry(curr);
+            }
+        }
+        curr = next;
+    }
 }
 
 // check_background_processes - Checks and reaps any terminated background processes.
 // It uses waitpid() in non-blocking mode (WNOHANG) to determine which background
 // processes have completed execution. Upon termination, it prints a message and
-// cleans up the process from the list.
+// cleans up the process from the list. Spooled jobs are kept until their output
+// has been flushed.
 void check_background_processes() {
     pid_t pid;
     int status;
 
     // Continuously check for any terminated background processes
     while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        trace_instant("reap", getpid(), -1);
+        BackgroundProcess *curr = head;
+        while (curr && (curr->pid != pid || curr->finished)) {
+            curr = curr->next;
+        }
+        if (curr && curr->out_spool >= 0) {
+            curr->finished = 1;  // Flushed below
+            continue;
+        }
         printf("[Background process %d terminated]\n", pid);
-        cleanup_background_process(pid);
+        if (curr && curr->coproc_name) {
+            // Kept until its output has been read
+            curr->finished = 1;
+            if (curr->coproc_in >= 0) {
+                close(curr->coproc_in);
+                curr->coproc_in = -1;
+            }
+            continue;
+        }
+        if (curr) {
+            remove_entry(curr);
+        }
     }
+    flush_finished_jobs();
+    release_drained_coprocs();
 }
 
 // cleanup_background_process - Removes a background process from the linked list.
 // It traverses the list, finds the process with the given PID, removes it,
 // and frees the allocated memory.
 void cleanup_background_process(pid_t pid) {
-    BackgroundProcess *prev = NULL, *curr = head;
-
     // Traverse the list to locate the process with the specified PID
-    while (curr) {
+    for (BackgroundProcess *curr = head; curr; curr = curr->next) {
         if (curr->pid == pid) {
-            // If it's not the head of the list, adjust the previous node's pointer
-            if (prev) {
-                prev->next = curr->next;
-            } else {
-                head = curr->next;
-            }
-            free(curr);  // Free the memory allocated for the process entry
+            remove_entry(curr);
             return;
         }
-        prev = curr;
-        curr = curr->next;
     }
 }
@@ -4,17 +4,39 @@
 
 #include <sys/types.h>
 
+// Output modes for background jobs (see the spool built-in):
+#define SPOOL_OFF 0         // Jobs write straight to the terminal
+#define SPOOL_COMPLETE 1    // Each job's output is written in one piece when it finishes
+#define SPOOL_ORDERED 2     // As SPOOL_COMPLETE, but always in launch order
+
 // BackgroundProcess structure:
 // Maintains information for a background process, including its process ID
 // and a pointer to the next process in the linked list.
 typedef struct BackgroundProcess {
     pid_t pid;                           // Process ID of the background process
+    long long start;                     // Start time for the GUSH_TRACE timeline
+    int out_spool;                       // Private file holding its stdout, -1 if not spooled
+    int err_spool;                       // Private file holding its stderr, -1 if not spooled
+    unsigned long seq;                   // Launch order, used by SPOOL_ORDERED
+    int finished;                        // Reaped, but its spool or coprocess output is not drained yet
+    char *coproc_name;                   // Name of a coprocess, NULL for an ordinary job
+    int coproc_in;                       // Shell's end of the coprocess's stdin, -1 once closed
+    int coproc_out;                      // Shell's end of the coprocess's stdout
     struct BackgroundProcess *next;      // Pointer to the next process in the list
 } BackgroundProcess;
 
 // Function declarations for background process management:
-void add_background_process(pid_t pid);
+void add_background_process(pid_t pid, int out_spool, int err_spool);
 void check_background_processes();
 void cleanup_background_process(pid_t pid);
+unsigned long background_launches();
+int open_spools(int *out_spool, int *err_spool);
+void set_spool_mode(int mode);
+int get_spool_mode();
+void add_coproc(pid_t pid, const char *name, int in_fd, int out_fd);
+BackgroundProcess *find_coproc(const char *name);
+int coproc_fd(const char *name, int output);
+void list_coprocs();
+void release_coproc(BackgroundProcess *coproc);
 
-#endif 
\ No newline at end of file
+#endif
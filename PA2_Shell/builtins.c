@@ -11,6 +11,8 @@
  *   - kill: Sends a SIGTERM signal to a specified process.
  *   - path: Updates the shell's search path for locating external executables.
  *   - clear: Clears the terminal screen.
+ *   - spool: Selects how the output of background jobs is written.
+ *   - coproc: Starts, lists and closes coprocesses.
  *
  * Additionally, it manages a command history buffer and provides the function 
  * add_to_history() to add new commands to the history.
@@ -23,8 +25,10 @@
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
 #include "utils.h"
 #include "execute.h"
+#include "background.h"
 
 #define MAX_HISTORY 10
 char history[MAX_HISTORY][1024];  // Circular buffer for storing command history
@@ -184,3 +188,115 @@ void builtin_path(char **args) {
     }
     search_paths[i - 1] = NULL;  // Null-terminate the search path array
 }
+
+/*
+ * builtin_spool - Selects the output mode for background jobs.
+ *
+ * "spool off" lets jobs write straight to the terminal (the default).
+ * "spool complete" writes each job's output in one piece when it finishes.
+ * "spool ordered" does the same, but always in the order the jobs were started.
+ * Without an argument, the current mode is printed.
+ */
+void builtin_spool(char **args) {
+    static const char *modes[] = {"off", "complete", "ordered"};
+
+    if (args[1] == NULL) {
+        printf("%s\n", modes[get_spool_mode()]);
+        return;
+    }
+    if (args[2] != NULL) {
+        print_error();  // Error: spool takes at most one argument
+        return;
+    }
+    for (int mode = SPOOL_OFF; mode <= SPOOL_ORDERED; mode++) {
+        if (strcmp(args[1], modes[mode]) == 0) {
+            set_spool_mode(mode);
+            return;
+        }
+    }
+    print_error();  // Error: unknown mode
+}
+
+/*
+ * builtin_coproc - Manages coprocesses.
+ *
+ * "coproc NAME cmd args..." starts cmd as a long-lived background process whose
+ * stdin and stdout are pipes kept open by the shell. Later commands write to it
+ * with ">&NAME" and read its replies with "<&NAME", so a tool with an expensive
+ * startup is launched only once.
+ * "coproc NAME" closes the coprocess's stdin so it can finish, and "coproc"
+ * alone lists the coprocesses. After a coprocess exits, its remaining output can
+ * still be read; it is removed once that has been read, or by "coproc NAME".
+ */
+void builtin_coproc(char **args) {
+    if (args[1] == NULL) {
+        list_coprocs();
+        return;
+    }
+
+    BackgroundProcess *existing = find_coproc(args[1]);
+    if (args[2] == NULL) {
+        if (existing != NULL && existing->finished) {
+            release_coproc(existing);  // Exited: discard any unread output
+            return;
+        }
+        // Close the input so the coprocess sees end of file
+        if (existing == NULL || existing->coproc_in < 0) {
+            print_error();
+            return;
+        }
+        close(existing->coproc_in);
+        existing->coproc_in = -1;
+        return;
+    }
+    if (existing != NULL) {
+        print_error();  // Error: name already in use
+        return;
+    }
+
+    char *full_path = find_executable(args[2]);
+    if (full_path == NULL) {
+        print_error();
+        return;
+    }
+    int to_child[2], from_child[2];
+    if (pipe(to_child) < 0) {
+        print_error();
+        return;
+    }
+    if (pipe(from_child) < 0) {
+        close(to_child[0]);
+        close(to_child[1]);
+        print_error();
+        return;
+    }
+    // Commands started later must not inherit the shell's ends
+    fcntl(to_child[1], F_SETFD, FD_CLOEXEC);
+    fcntl(from_child[0], F_SETFD, FD_CLOEXEC);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        print_error();
+        close(to_child[0]);
+        close(to_child[1]);
+        close(from_child[0]);
+        close(from_child[1]);
+        return;
+    }
+    if (pid == 0) {
+        if (dup2(to_child[0], STDIN_FILENO) < 0 || dup2(from_child[1], STDOUT_FILENO) < 0) {
+            print_error();
+            _exit(1);
+        }
+        close(to_child[0]);
+        close(from_child[1]);
+        execve(full_path, &args[2], NULL);
+        print_error();
+        _exit(1);
+    }
+
+    close(to_child[0]);
+    close(from_child[1]);
+    printf("[Background process %d started]\n", pid);
+    add_coproc(pid, args[1], to_child[1], from_child[0]);
+}
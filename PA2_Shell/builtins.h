@@ -19,6 +19,8 @@ void builtin_clear();
 void builtin_history(char **args);
 void builtin_kill(char **args);
 void builtin_path(char **args);
+void builtin_spool(char **args);
+void builtin_coproc(char **args);
 void add_to_history(char *cmd);
 
 #endif
@@ -0,0 +1,628 @@
+/*
+ * compress.c
+ *
+ * Implements transparent compression for redirections whose target ends in
+ * a compression suffix, e.g.
+ *
+ *     sort big.txt > sorted.txt.gz
+ *     grep error < log.gz
+ *
+ * Before forking, open_compressed_streams() opens the file, creates a pipe and
+ * starts a thread in the shell that compresses what the command writes into the
+ * pipe (or decompresses the file into the pipe), so no external gzip process and
+ * no uncompressed copy on disk are needed. handle_redirection() then dup2()s the
+ * pipe end instead of opening the file.
+ *
+ * An output file is not truncated, and its thread not started, until the
+ * command has been forked (release_compressed_streams()). If the command
+ * cannot be started, cancel_compressed_streams() leaves existing files as
+ * they were.
+ *
+ * Supported formats: .gz (zlib) and, when built with ZSTD=1, .zst (libzstd).
+ * The environment variables GUSH_COMPRESS_LEVEL and GUSH_COMPRESS_THREADS set
+ * the compression level and the number of compression threads. With more than
+ * one thread, gzip output is written as independent 1 MiB members compressed in
+ * parallel, which any gzip reader decompresses as a single stream.
+ */
+
+#include "compress.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define CHUNK_SIZE (128 * 1024)       // Buffer size for streaming (de)compression
+#define BLOCK_SIZE (1024 * 1024)      // Input compressed by each thread in parallel gzip
+#define MAX_COMPRESS_THREADS 32
+
+#define FORMAT_NONE 0
+#define FORMAT_GZIP 1
+#define FORMAT_ZSTD 2
+
+static CompressedStream *pending = NULL;   // Opened, command not started yet
+static CompressedStream *running = NULL;   // Handed to a command, thread may still run
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+static int exit_handler = 0;               // finish_all_streams() is registered
+
+// GzipBlock structure:
+// One block of input compressed into its own gzip member by a worker thread.
+typedef struct GzipBlock {
+    const unsigned char *in;
+    size_t in_len;
+    unsigned char *out;
+    size_t out_len;
+    int level;
+    int ok;
+} GzipBlock;
+
+/*
+ * format_for - Returns the compression format selected by the file name suffix.
+ */
+static int format_for(const char *filename) {
+    size_t len = strlen(filename);
+    if (len > 3 && strcmp(filename + len - 3, ".gz") == 0) {
+        return FORMAT_GZIP;
+    }
+    if (len > 4 && strcmp(filename + len - 4, ".zst") == 0) {
+        return FORMAT_ZSTD;
+    }
+    return FORMAT_NONE;
+}
+
+/*
+ * read_full - Reads until len bytes are read or end of file is reached.
+ * Returns the number of bytes read, or -1 on error.
+ */
+static ssize_t read_full(int fd, unsigned char *buf, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = read(fd, buf + total, len - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+/*
+ * gzip_compress - Compresses everything read from the pipe into one gzip stream.
+ */
+static int gzip_compress(CompressedStream *s, unsigned char *in, unsigned char *out) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    int level = (s->level < 0) ? Z_DEFAULT_COMPRESSION : s->level;
+    if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return -1;
+    }
+
+    int flush = Z_NO_FLUSH;
+    int result = 0;
+    while (flush != Z_FINISH && result == 0) {
+        ssize_t n = read_full(s->pipe_fd, in, CHUNK_SIZE);
+        if (n < CHUNK_SIZE) {
+            flush = Z_FINISH;  // End of input (a read error also ends the stream)
+            if (n < 0) {
+                n = 0;
+            }
+        }
+        zs.next_in = in;
+        zs.avail_in = n;
+        do {
+            zs.next_out = out;
+            zs.avail_out = CHUNK_SIZE;
+            deflate(&zs, flush);
+            if (write_all(s->file_fd, out, CHUNK_SIZE - zs.avail_out) < 0) {
+                result = -1;
+                break;
+            }
+        } while (zs.avail_out == 0);
+    }
+    deflateEnd(&zs);
+    return result;
+}
+
+/*
+ * gzip_block_worker - Compresses one block into a complete gzip member.
+ */
+static void *gzip_block_worker(void *arg) {
+    GzipBlock *block = (GzipBlock *)arg;
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    block->ok = 0;
+    block->out = NULL;
+    if (deflateInit2(&zs, block->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return NULL;
+    }
+    uLong bound = deflateBound(&zs, block->in_len);
+    block->out = (unsigned char *)malloc(bound);
+    if (block->out != NULL) {
+        zs.next_in = (unsigned char *)block->in;
+        zs.avail_in = block->in_len;
+        zs.next_out = block->out;
+        zs.avail_out = bound;
+        if (deflate(&zs, Z_FINISH) == Z_STREAM_END) {
+            block->out_len = bound - zs.avail_out;
+            block->ok = 1;
+        }
+    }
+    deflateEnd(&zs);
+    return NULL;
+}
+
+/*
+ * gzip_compress_parallel - Compresses the pipe as a series of gzip members,
+ * one BLOCK_SIZE block per thread at a time, written back in input order.
+ */
+static int gzip_compress_parallel(CompressedStream *s) {
+    unsigned char *in = (unsigned char *)malloc((size_t)s->threads * BLOCK_SIZE);
+    if (in == NULL) {
+        return -1;
+    }
+    GzipBlock blocks[MAX_COMPRESS_THREADS];
+    pthread_t workers[MAX_COMPRESS_THREADS];
+    int level = (s->level < 0) ? Z_DEFAULT_COMPRESSION : s->level;
+    int eof = 0, wrote_any = 0, result = 0;
+
+    while (!eof && result == 0) {
+        // Fill up to one block per thread
+        int count = 0;
+        while (count < s->threads && !eof) {
+            unsigned char *buf = in + (size_t)count * BLOCK_SIZE;
+            ssize_t n = read_full(s->pipe_fd, buf, BLOCK_SIZE);
+            if (n < BLOCK_SIZE) {
+                eof = 1;
+            }
+            if (n <= 0 && (wrote_any || count > 0)) {
+                break;
+            }
+            // An empty input still produces one (empty) gzip member
+            blocks[count].in = buf;
+            blocks[count].in_len = (n < 0) ? 0 : n;
+            blocks[count].level = level;
+            count++;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        // Compress the blocks in parallel; the first one runs on this thread
+        int started = 1;
+        for (int i = 1; i < count; i++, started++) {
+            if (pthread_create(&workers[i], NULL, gzip_block_worker, &blocks[i]) != 0) {
+                break;
+            }
+        }
+        for (int i = started; i < count; i++) {
+            gzip_block_worker(&blocks[i]);  // Could not start a thread: compress here
+        }
+        gzip_block_worker(&blocks[0]);
+        for (int i = 1; i < started; i++) {
+            pthread_join(workers[i], NULL);
+        }
+
+        // Write the members in order
+        for (int i = 0; i < count; i++) {
+            if (result == 0 && (!blocks[i].ok ||
+                                write_all(s->file_fd, blocks[i].out, blocks[i].out_len) < 0)) {
+                result = -1;
+            }
+            free(blocks[i].out);
+        }
+        wrote_any = 1;
+    }
+    free(in);
+    return result;
+}
+
+/*
+ * gzip_decompress - Decompresses a gzip (or zlib) file into the pipe.
+ * Files made of several gzip members are decompressed as one stream.
+ */
+static int gzip_decompress(CompressedStream *s, unsigned char *in, unsigned char *out) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) {  // +32: detect gzip or zlib header
+        return -1;
+    }
+
+    int result = 0;
+    ssize_t n;
+    while (result == 0 && (n = read_full(s->file_fd, in, CHUNK_SIZE)) > 0) {
+        zs.next_in = in;
+        zs.avail_in = n;
+        do {
+            zs.next_out = out;
+            zs.avail_out = CHUNK_SIZE;
+            int ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR || ret == Z_MEM_ERROR ||
+                ret == Z_STREAM_ERROR) {
+                print_error();  // Corrupt input
+                result = -1;
+                break;
+            }
+            if (write_all(s->pipe_fd, out, CHUNK_SIZE - zs.avail_out) < 0) {
+                result = -1;  // The command stopped reading
+                break;
+            }
+            if (ret == Z_STREAM_END) {
+                inflateReset(&zs);  // Continue with the next member
+            }
+        } while (zs.avail_in > 0 || zs.avail_out == 0);
+    }
+    inflateEnd(&zs);
+    return result;
+}
+
+#ifdef HAVE_ZSTD
+/*
+ * zstd_compress - Compresses everything read from the pipe into one zstd frame.
+ */
+static int zstd_compress(CompressedStream *s, unsigned char *in, unsigned char *out) {
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (cctx == NULL) {
+        return -1;
+    }
+    if (s->level >= 0) {
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, s->level);
+    }
+    if (s->threads > 1) {
+        // Ignored by libzstd builds without multithreading support
+        ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, s->threads);
+    }
+
+    int result = 0;
+    int finished = 0;
+    while (!finished && result == 0) {
+        ssize_t n = read_full(s->pipe_fd, in, CHUNK_SIZE);
+        ZSTD_EndDirective mode = (n < CHUNK_SIZE) ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer input = { in, (n < 0) ? 0 : (size_t)n, 0 };
+        int done;
+        do {
+            ZSTD_outBuffer output = { out, CHUNK_SIZE, 0 };
+            size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(remaining) || write_all(s->file_fd, out, output.pos) < 0) {
+                result = -1;
+                break;
+            }
+            done = (mode == ZSTD_e_end) ? (remaining == 0) : (input.pos == input.size);
+        } while (!done);
+        finished = (mode == ZSTD_e_end);
+    }
+    ZSTD_freeCCtx(cctx);
+    return result;
+}
+
+/*
+ * zstd_decompress - Decompresses a zstd file (one or more frames) into the pipe.
+ */
+static int zstd_decompress(CompressedStream *s, unsigned char *in, unsigned char *out) {
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    if (dctx == NULL) {
+        return -1;
+    }
+
+    int result = 0;
+    ssize_t n;
+    while (result == 0 && (n = read_full(s->file_fd, in, CHUNK_SIZE)) > 0) {
+        ZSTD_inBuffer input = { in, (size_t)n, 0 };
+        while (input.pos < input.size) {
+            ZSTD_outBuffer output = { out, CHUNK_SIZE, 0 };
+            size_t ret = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(ret)) {
+                print_error();  // Corrupt input
+                result = -1;
+                break;
+            }
+            if (write_all(s->pipe_fd, out, output.pos) < 0) {
+                result = -1;  // The command stopped reading
+                break;
+            }
+        }
+    }
+    ZSTD_freeDCtx(dctx);
+    return result;
+}
+#endif
+
+/*
+ * stream_thread - Moves data between the pipe and the compressed file until
+ * the command closes its end of the pipe (or the input file is exhausted).
+ */
+static void *stream_thread(void *arg) {
+    CompressedStream *s = (CompressedStream *)arg;
+
+    // A command that exits early must not kill the shell with SIGPIPE;
+    // the write fails with EPIPE instead.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    unsigned char *in = (unsigned char *)malloc(CHUNK_SIZE);
+    unsigned char *out = (unsigned char *)malloc(CHUNK_SIZE);
+    if (in != NULL && out != NULL) {
+        if (s->format == FORMAT_GZIP && s->output && s->threads > 1) {
+            gzip_compress_parallel(s);
+        } else if (s->format == FORMAT_GZIP && s->output) {
+            gzip_compress(s, in, out);
+        } else if (s->format == FORMAT_GZIP) {
+            gzip_decompress(s, in, out);
+#ifdef HAVE_ZSTD
+        } else if (s->output) {
+            zstd_compress(s, in, out);
+        } else {
+            zstd_decompress(s, in, out);
+#endif
+        }
+    }
+    free(in);
+    free(out);
+
+    close(s->pipe_fd);
+    close(s->file_fd);
+    pthread_mutex_lock(&done_lock);
+    s->done = 1;
+    pthread_mutex_unlock(&done_lock);
+    return NULL;
+}
+
+/*
+ * env_setting - Reads a non-negative integer setting from the environment.
+ */
+static int env_setting(const char *name, int fallback, int max) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    char *endptr;
+    long n = strtol(value, &endptr, 10);
+    if (*endptr != '\0' || n < 0) {
+        return fallback;
+    }
+    return (n > max) ? max : (int)n;
+}
+
+/*
+ * finish_all_streams - Lets every compression thread finish before the shell exits,
+ * so no compressed output is left truncated.
+ */
+static void finish_all_streams() {
+    cancel_compressed_streams();
+    while (running != NULL) {
+        CompressedStream *s = running;
+        running = s->next;
+        pthread_join(s->thread, NULL);
+        free(s->filename);
+        free(s);
+    }
+}
+
+/*
+ * start_stream - Opens the compressed file and, for '<', starts its thread.
+ * The thread for '>' is started by release_compressed_streams(). On success,
+ * *target is replaced by the stream's own copy of the file name, which is how
+ * handle_redirection() recognizes it in the child.
+ */
+static int start_stream(char **target, int output, int format) {
+#ifndef HAVE_ZSTD
+    if (format == FORMAT_ZSTD) {
+        return -1;  // Built without libzstd
+    }
+#endif
+    CompressedStream *s = (CompressedStream *)calloc(1, sizeof(CompressedStream));
+    if (s == NULL) {
+        return -1;
+    }
+    s->filename = strdup(*target);
+    s->output = output;
+    s->format = format;
+    s->level = env_setting("GUSH_COMPRESS_LEVEL", -1, (format == FORMAT_GZIP) ? 9 : 22);
+    s->threads = env_setting("GUSH_COMPRESS_THREADS", 1, MAX_COMPRESS_THREADS);
+    if (s->threads < 1) {
+        s->threads = 1;
+    }
+
+    if (output) {
+        // Not truncated yet: the command may still fail to start
+        s->file_fd = open(*target, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        s->created = (s->file_fd >= 0);
+        if (s->file_fd < 0 && errno == EEXIST) {
+            s->file_fd = open(*target, O_WRONLY);
+        }
+    } else {
+        s->file_fd = open(*target, O_RDONLY);
+    }
+    int fds[2];
+    if (s->filename == NULL || s->file_fd < 0 || pipe(fds) < 0) {
+        if (s->file_fd >= 0) {
+            close(s->file_fd);
+        }
+        free(s->filename);
+        free(s);
+        return -1;
+    }
+    // The command writes into fds[1] for '>' and reads from fds[0] for '<'
+    s->child_fd = output ? fds[1] : fds[0];
+    s->pipe_fd = output ? fds[0] : fds[1];
+
+    // No other command may inherit these descriptors, or the thread would never see EOF
+    fcntl(s->file_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    if (!output && pthread_create(&s->thread, NULL, stream_thread, s) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        close(s->file_fd);
+        free(s->filename);
+        free(s);
+        return -1;
+    }
+    s->started = !output;
+
+    if (!exit_handler) {
+        exit_handler = 1;
+        atexit(finish_all_streams);
+    }
+    s->next = pending;
+    pending = s;
+    *target = s->filename;
+    return 0;
+}
+
+/*
+ * open_compressed_streams - Starts a stream for every '<' or '>' in args whose
+ * file name ends in a compression suffix. Must be called in the shell before fork().
+ * Returns 0 on success, or -1 (after cleaning up) if a stream cannot be started.
+ */
+int open_compressed_streams(char **args) {
+    for (int i = 0; args[i] != NULL; i++) {
+        int output;
+        if (strcmp(args[i], "<") == 0) {
+            output = 0;
+        } else if (strcmp(args[i], ">") == 0) {
+            output = 1;
+        } else {
+            continue;
+        }
+        if (args[i + 1] == NULL) {
+            break;  // Reported by handle_redirection()
+        }
+        i++;
+        int format = format_for(args[i]);
+        if (format != FORMAT_NONE && start_stream(&args[i], output, format) < 0) {
+            cancel_compressed_streams();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * compressed_stream_fd - Returns the pipe end to use for a redirection target,
+ * or -1 if it is an ordinary file. Called by handle_redirection() in the child.
+ */
+int compressed_stream_fd(const char *filename, int output) {
+    for (CompressedStream *s = pending; s != NULL; s = s->next) {
+        if (s->filename == filename && s->output == output) {
+            return s->child_fd;
+        }
+    }
+    return -1;
+}
+
+/*
+ * release_compressed_streams - Called in the shell after forking the command(s):
+ * truncates output files and starts their threads, and closes the shell's copy
+ * of the command's pipe ends so the threads see EOF when the command exits.
+ */
+void release_compressed_streams(int background) {
+    while (pending != NULL) {
+        CompressedStream *s = pending;
+        pending = s->next;
+        close(s->child_fd);
+        s->child_fd = -1;
+        if (!s->started) {
+            if (ftruncate(s->file_fd, 0) < 0 ||
+                pthread_create(&s->thread, NULL, stream_thread, s) != 0) {
+                print_error();  // The command's writes fail with EPIPE
+                close(s->pipe_fd);
+                close(s->file_fd);
+                free(s->filename);
+                free(s);
+                continue;
+            }
+            s->started = 1;
+        }
+        s->background = background;
+        s->next = running;
+        running = s;
+    }
+}
+
+/*
+ * cancel_compressed_streams - Called in the shell when the command(s) will not
+ * be started: stops the threads and closes everything, without touching output
+ * files that already existed.
+ */
+void cancel_compressed_streams() {
+    while (pending != NULL) {
+        CompressedStream *s = pending;
+        pending = s->next;
+        close(s->child_fd);  // A '<' thread now fails with EPIPE and exits
+        if (s->started) {
+            pthread_join(s->thread, NULL);
+        } else {
+            close(s->pipe_fd);
+            close(s->file_fd);
+            if (s->created) {
+                unlink(s->filename);
+            }
+        }
+        free(s->filename);
+        free(s);
+    }
+}
+
+/*
+ * wait_compressed_streams - Waits for the threads of foreground commands.
+ */
+void wait_compressed_streams() {
+    CompressedStream *prev = NULL, *curr = running;
+    while (curr) {
+        CompressedStream *next = curr->next;
+        if (!curr->background) {
+            pthread_join(curr->thread, NULL);
+            if (prev) {
+                prev->next = next;
+            } else {
+                running = next;
+            }
+            free(curr->filename);
+            free(curr);
+        } else {
+            prev = curr;
+        }
+        curr = next;
+    }
+}
+
+/*
+ * reap_compressed_streams - Cleans up the finished threads of background jobs.
+ */
+void reap_compressed_streams() {
+    CompressedStream *prev = NULL, *curr = running;
+    while (curr) {
+        CompressedStream *next = curr->next;
+        pthread_mutex_lock(&done_lock);
+        int done = curr->done;
+        pthread_mutex_unlock(&done_lock);
+        if (done) {
+            pthread_join(curr->thread, NULL);
+            if (prev) {
+                prev->next = next;
+            } else {
+                running = next;
+            }
+            free(curr->filename);
+            free(curr);
+        } else {
+            prev = curr;
+        }
+        curr = next;
+    }
+}
@@ -0,0 +1,35 @@
+//This is the header file for compress.c
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <pthread.h>
+
+// CompressedStream structure:
+// A redirection whose target ends in a compression suffix. The command reads
+// from or writes to a pipe, and a thread in the shell moves the data between
+// that pipe and the compressed file.
+typedef struct CompressedStream {
+    char *filename;                  // Target file, also stored in the command's args
+    int output;                      // 1 for '>' (compress), 0 for '<' (decompress)
+    int format;                      // Compression format of the file
+    int file_fd;                     // Compressed file
+    int pipe_fd;                     // Pipe end used by the thread
+    int child_fd;                    // Pipe end handed to the command
+    int level;                       // Compression level, -1 = library default
+    int threads;                     // Compression threads
+    int background;                  // Belongs to a background job
+    int created;                     // '>' created the file (removed if cancelled)
+    int started;                     // The thread is running
+    int done;                        // Set by the thread when it finishes
+    pthread_t thread;
+    struct CompressedStream *next;
+} CompressedStream;
+
+int open_compressed_streams(char **args);
+int compressed_stream_fd(const char *filename, int output);
+void release_compressed_streams(int background);
+void cancel_compressed_streams();
+void wait_compressed_streams();
+void reap_compressed_streams();
+
+#endif
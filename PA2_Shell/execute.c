@@ -18,11 +18,16 @@
 #include "redirection.h"
 #include "pipes.h"
 #include "background.h"
+#include "policy.h"
+#include "compress.h"
+#include "trace.h"
+#include "heredoc.h"
 
 #define MAX_ARG_SIZE 64
 #define MAX_PATHS 10
 
 char *search_paths[MAX_PATHS] = {"/bin", "/usr/bin", NULL}; // Default search path
+int last_status = 0;  // Exit status of the last command
 
 /*
  * find_executable - Resolves a command to its full path by checking search paths.
@@ -51,23 +56,53 @@ char *find_executable(char *cmd) {
     return NULL; // Command not found in search_paths
 }
 
+/*
+ * find_job_separator - Returns the first '&' that separates background jobs,
+ * skipping the '&' of the coprocess redirections ">&NAME" and "<&NAME".
+ */
+static char *find_job_separator(char *cmd) {
+    for (char *p = cmd; (p = strchr(p, '&')) != NULL; p++) {
+        if (p == cmd || (p[-1] != '>' && p[-1] != '<')) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * next_job - Splits a line into background jobs, like strtok_r() with "&" as
+ * the delimiter but leaving coprocess redirections intact.
+ */
+static char *next_job(char *str, char **saveptr) {
+    char *start = (str != NULL) ? str : *saveptr;
+    if (start == NULL) {
+        return NULL;
+    }
+    char *sep = find_job_separator(start);
+    if (sep != NULL) {
+        *sep = '\0';
+        *saveptr = sep + 1;
+    } else {
+        *saveptr = NULL;
+    }
+    return start;
+}
+
 /*
  * execute_command - Processes and executes a command.
  * It checks for pipes, handles history recall, stores the command in history,
  * and then forks. In the child process, it processes redirection and executes
  * external commands using execve(). Built-in commands are handled in the parent.
+ * A child that fails before execve() leaves with _exit(), so it does not flush
+ * the shell's stdio buffers (duplicating output or rewinding the batch file).
  */
 void execute_command(char *cmd) {
-    // Check for pipes first.
-    if (strchr(cmd, '|') != NULL) {
-        if (execute_piped_commands(cmd) < 0) {
-            print_error();
-        }
-        return;
-    }
-    
-    // Handle history recall if the command starts with '!'
-    if (cmd[0] == '!' && cmd[1] != '\0') {
+    long long parse_start = trace_now();
+    last_status = 1;  // Until a command actually runs
+
+    // Handle history recall if the command starts with '!'. History keeps the
+    // whole line, so a recalled "with ..." prefix is parsed again below.
+    if (cmd[0] == '!' && cmd[1] != '\0' && strchr(cmd, '|') == NULL) {
         int index = atoi(cmd + 1);
         if (index <= 0 || index > history_count) {
             print_error();
@@ -76,18 +111,47 @@ void execute_command(char *cmd) {
         strcpy(cmd, history[index - 1]);
         printf("%s\n", cmd);
     }
+    char *original = cmd;
+
+    // Strip an optional "with ..." policy prefix; it applies to every command on the line.
+    ExecPolicy policy;
+    policy_init(&policy);
+    char *line = parse_policy_prefix(cmd, &policy);
+    if (line == NULL) {
+        print_error();
+        return;
+    }
+    cmd = line;
+
+    // Check for pipes first.
+    if (strchr(cmd, '|') != NULL) {
+        if (execute_piped_commands(cmd, &policy) < 0) {
+            print_error();
+        }
+        return;
+    }
     
-add_to_history(cmd);
+add_to_history(original);
 
 // Check if the command contains '&'
-if (strchr(cmd, '&') != NULL) {
+if (find_job_separator(cmd) != NULL) {
     // Duplicate the command for splitting.
     char *cmd_dup = strdup(cmd);
-    char *saveptr; // For outer strtok_r
-    char *sub_cmd = strtok_r(cmd_dup, "&", &saveptr);
+    char *saveptr; // For next_job
+    char *sub_cmd = next_job(cmd_dup, &saveptr);
+    int job = 0;
     while (sub_cmd != NULL) {
-        char *trimmed_cmd = trim(sub_cmd);
+        // Each job may add its own "with ..." prefix on top of the line's policy.
+        ExecPolicy job_policy = policy;
+        char *trimmed_cmd = parse_policy_prefix(sub_cmd, &job_policy);
+        if (trimmed_cmd == NULL) {
+            print_error();
+            sub_cmd = next_job(NULL, &saveptr);
+            continue;
+        }
+        trimmed_cmd = trim(trimmed_cmd);
         if (strlen(trimmed_cmd) > 0) {
+            long long job_parse_start = trace_now();
             char *args[MAX_ARG_SIZE];
             int i = 0;
             char *token;
@@ -98,32 +162,63 @@ if (strchr(cmd, '&') != NULL) {
                 token = strtok_r(NULL, " \t\n", &inner_saveptr);
             }
             args[i] = NULL;
+            trace_span("parse", job_parse_start, getpid(), job);
             
             // Process as a background command (assuming external command)
+            long long lookup_start = trace_now();
             char *full_path = find_executable(args[0]);
-            if (full_path == NULL) {
+            trace_span("find_executable", lookup_start, getpid(), job);
+            if (full_path == NULL || open_input_documents(args) < 0) {
+                print_error();
+            } else if (check_redirections(args) < 0 || open_compressed_streams(args) < 0) {
                 print_error();
+                release_input_documents();
             } else {
-                pid_t pid = fork();
+                // With spooling on, the job's output goes to private spool files
+                int out_spool, err_spool;
+                long long fork_start = trace_now();
+                pid_t pid = (open_spools(&out_spool, &err_spool) < 0) ? -1 : fork();
                 if (pid < 0) {
                     print_error();
+                    cancel_compressed_streams();
+                    release_input_documents();
+                    if (out_spool >= 0) {
+                        close(out_spool);
+                        close(err_spool);
+                    }
                 } else if (pid == 0) {
+                    long long setup_start = trace_now();
+                    if (out_spool >= 0 && (dup2(out_spool, STDOUT_FILENO) < 0 ||
+                                           dup2(err_spool, STDERR_FILENO) < 0)) {
+                        _exit(1);
+                    }
                     if (handle_redirection(args) < 0) {
-                        exit(1);
+                        _exit(1);
+                    }
+                    if (apply_policy(&job_policy, job) < 0) {
+                        _exit(1);
                     }
+                    trace_span("setup", setup_start, getpid(), job);
+                    trace_instant("execve", getpid(), job);
                     execve(full_path, args, NULL);
                     print_error();
-                    exit(1);
+                    _exit(1);
                 } else {
+                    trace_span("fork", fork_start, getpid(), job);
+                    release_compressed_streams(1);
+                    release_input_documents();
                     printf("[Background process %d started]\n", pid);
-                    add_background_process(pid);
+                    add_background_process(pid, out_spool, err_spool);
                 }
             }
+            job++;
         }
-        sub_cmd = strtok_r(NULL, "&", &saveptr);
+        sub_cmd = next_job(NULL, &saveptr);
     }
     free(cmd_dup);
+    last_status = 0;
     check_background_processes();
+    reap_compressed_streams();
     return;
 }
 
@@ -138,6 +233,8 @@ if (strchr(cmd, '&') != NULL) {
         token = strtok(NULL, " \t\n");
     }
     args[i] = NULL;
+    trace_span("parse", parse_start, getpid(), 0);
+    last_status = 0;
     
     // Check for built-in commands.
     if (strcmp(args[0], "exit") == 0) {
@@ -168,26 +265,71 @@ if (strchr(cmd, '&') != NULL) {
         builtin_clear();
         return;
     }
+    if (strcmp(args[0], "spool") == 0) {
+        builtin_spool(args);
+        return;
+    }
+    if (strcmp(args[0], "coproc") == 0) {
+        builtin_coproc(args);
+        return;
+    }
     
+    long long lookup_start = trace_now();
     char *full_path = find_executable(args[0]);
+    trace_span("find_executable", lookup_start, getpid(), 0);
     if (full_path == NULL) {
         print_error();
+        last_status = 127;
+        return;
+    }
+
+    // Prepare here-documents, then start (de)compression threads for
+    // redirections to .gz/.zst files
+    if (open_input_documents(args) < 0) {
+        print_error();
+        last_status = 1;
+        return;
+    }
+    if (check_redirections(args) < 0 || open_compressed_streams(args) < 0) {
+        print_error();
+        release_input_documents();
+        last_status = 1;
         return;
     }
     
+    long long fork_start = trace_now();
     pid_t pid = fork();
     if (pid < 0) {
         print_error();
+        cancel_compressed_streams();
+        release_input_documents();
+        last_status = 1;
     } else if (pid == 0) {
+        long long setup_start = trace_now();
         if (handle_redirection(args) < 0) {
-            exit(1);
+            _exit(1);
+        }
+        if (apply_policy(&policy, 0) < 0) {
+            _exit(1);
         }
+        trace_span("setup", setup_start, getpid(), 0);
+        trace_instant("execve", getpid(), 0);
         execve(full_path, args, NULL);
         print_error();
-        exit(1);
+        _exit(1);
     } else {
-        waitpid(pid, NULL, 0);
+        trace_span("fork", fork_start, getpid(), 0);
+        release_compressed_streams(0);
+        release_input_documents();
+        long long reap_start = trace_now();
+        int status;
+        waitpid(pid, &status, 0);
+        last_status = exit_code(status);
+        trace_span("reap", reap_start, getpid(), 0);
+        trace_span("process", fork_start, pid, 0);
     }
+    wait_compressed_streams();
     printf("Executing command: %s\n", full_path);
     check_background_processes();
+    reap_compressed_streams();
 }
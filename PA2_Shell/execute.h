@@ -9,8 +9,10 @@
 
 #define MAX_PATHS 10  
 #define MAX_ARG_SIZE 64  
+#define MAX_INPUT_SIZE 1024  // Maximum command length, also after variable expansion
 
 extern char *search_paths[MAX_PATHS];
+extern int last_status;  // Exit status of the last command, used by while loops and $?
 
 void execute_command(char *cmd);
 char *find_executable(char *cmd);
@@ -2,6 +2,8 @@
 /*
  * gush.c - Main shell logic (Final Edition)
  * Handles interactive mode (with prompt) and batch mode (reading from a file).
+ *
+ * Usage: gush [--journal file [--resume]] [batch file]
  */
 
 #include <stdio.h>
@@ -10,14 +12,19 @@
 #include "execute.h"
 #include "builtins.h"
 #include "utils.h"
-
-#define MAX_INPUT_SIZE 1024  // Maximum command length
+#include "trace.h"
+#include "heredoc.h"
+#include "script.h"
+#include "prefetch.h"
+#include "journal.h"
+#include "background.h"
 
 /*
  * interactive_mode - Runs the shell in interactive mode.
  */
 void interactive_mode() {
     char input[MAX_INPUT_SIZE];
+    int line = 0;
 
     while (1) {
         printf("gush> ");
@@ -27,7 +34,12 @@ void interactive_mode() {
             exit(0);
         }
 
-        execute_command(input);
+        trace_set_line(++line);
+        if (read_heredocs(input, stdin, &line, 1) < 0 ||
+            run_script_line(input, stdin, &line, 1) < 0) {
+            print_error();
+        }
+        discard_heredocs();
     }
 }
 
@@ -41,9 +53,33 @@ void batch_mode(char *filename) {
         exit(1);
     }
 
+    prefetch_init(filename);  // Read upcoming binaries and input files ahead of time
+
     char input[MAX_INPUT_SIZE];
+    int line = 0;
     while (fgets(input, MAX_INPUT_SIZE, file)) {
-        execute_command(input);
+        trace_set_line(++line);
+        prefetch_advance(line);
+        if (journal_skip(file, input, &line)) {
+            continue;  // Completed by the run being resumed
+        }
+
+        int first_line = line;
+        long start_pos = ftell(file);
+        unsigned long launches = background_launches();
+        int failed = 0;
+        // Here-document bodies follow their command line in the script
+        if (read_heredocs(input, file, &line, 0) < 0 ||
+            run_script_line(input, file, &line, 0) < 0) {
+            print_error();
+            failed = 1;
+        }
+        discard_heredocs();
+        // A line that started background jobs has not finished when it returns,
+        // so it is not journaled and always runs again on resume
+        if (background_launches() == launches) {
+            journal_record(file, input, first_line, line, start_pos, failed ? 1 : last_status);
+        }
     }
     
     fclose(file);
@@ -54,13 +90,37 @@ void batch_mode(char *filename) {
  * main - Entry point of the shell.
  */
 int main(int argc, char *argv[]) {
-    if (argc > 2) {
+    char *script = NULL;
+    char *journal = NULL;
+    int resume = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+            journal = argv[++i];
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = 1;
+        } else if (script == NULL && strncmp(argv[i], "--", 2) != 0) {
+            script = argv[i];
+        } else {
+            print_error();
+            exit(1);
+        }
+    }
+    // A journal needs a batch file, and resuming needs a journal
+    if ((journal != NULL && script == NULL) || (resume && journal == NULL)) {
+        print_error();
+        exit(1);
+    }
+
+    trace_init();  // Record a timeline if GUSH_TRACE is set
+
+    if (journal != NULL && journal_open(journal, resume) < 0) {
         print_error();
         exit(1);
     }
 
-    if (argc == 2) {
-        batch_mode(argv[1]); 
+    if (script != NULL) {
+        batch_mode(script); 
     } else {
         interactive_mode(); 
     }
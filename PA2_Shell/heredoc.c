@@ -0,0 +1,363 @@
+/*
+ * heredoc.c
+ *
+ * Implements here-documents and here-strings:
+ *
+ *     cat <<EOF            sort <<< word
+ *     line one
+ *     line two
+ *     EOF
+ *
+ * read_heredocs() is called by the input loop in gush.c for every line read (and
+ * by script.c for the continuation lines of a loop); it reads the body of each
+ * "<<WORD" on the line from the same input, up to a line containing only WORD.
+ * script.c then attaches the bodies to their statements with take_heredocs() and
+ * hands them back with queue_heredocs() each time a statement runs, so a loop
+ * body gets a fresh copy of its here-documents on every pass. Before forking,
+ * open_input_documents() turns each here-document or here-string in the
+ * command's args into a file descriptor and rewrites it as an ordinary "<"
+ * redirection that handle_redirection() recognizes.
+ *
+ * Small bodies are written into a pipe. Larger ones, or ones that do not fit
+ * because the pipe buffer is smaller than usual, go into a sealed memfd (on
+ * Linux), so no temporary file is ever created on disk.
+ */
+
+#define _GNU_SOURCE  // Needed for memfd_create() and file sealing
+
+#include "heredoc.h"
+#include "execute.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define HEREDOC_PIPE_MAX 16384    // Larger bodies would not fit in a default pipe buffer
+
+static HereDoc *heredocs = NULL;          // Bodies read for the current line, in order
+static HereDoc *heredocs_tail = NULL;
+static InputDocument *pending = NULL;     // Descriptors for the command being started
+
+/*
+ * read_body - Reads lines from in until a line equal to delim (or end of input).
+ */
+static HereDoc *read_body(const char *delim, size_t delim_len, FILE *in, int *line_count,
+                          int interactive) {
+    HereDoc *doc = (HereDoc *)calloc(1, sizeof(HereDoc));
+    if (doc == NULL) {
+        return NULL;
+    }
+    size_t cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t n;
+
+    while (1) {
+        if (interactive) {
+            printf("> ");
+            fflush(stdout);
+        }
+        if ((n = getline(&line, &line_cap, in)) < 0) {
+            break;  // End of input also ends the here-document
+        }
+        (*line_count)++;
+        size_t text_len = (n > 0 && line[n - 1] == '\n') ? (size_t)n - 1 : (size_t)n;
+        if (text_len == delim_len && strncmp(line, delim, delim_len) == 0) {
+            break;
+        }
+        if (doc->len + n + 1 > cap) {
+            cap = (doc->len + n + 1) * 2;
+            char *body = (char *)realloc(doc->body, cap);
+            if (body == NULL) {
+                free(line);
+                free(doc->body);
+                free(doc);
+                return NULL;
+            }
+            doc->body = body;
+        }
+        memcpy(doc->body + doc->len, line, n);
+        doc->len += n;
+    }
+    free(line);
+    return doc;
+}
+
+/*
+ * find_heredoc - Finds the next "<<WORD" in text, skipping "<<<" here-strings.
+ * Returns a pointer to WORD and sets *len to its length (0 if the word is
+ * missing), or returns NULL if there is none.
+ */
+const char *find_heredoc(const char *text, size_t *len) {
+    const char *p = text;
+    while ((p = strstr(p, "<<")) != NULL) {
+        if (p[2] == '<') {
+            p += 3;  // Here-string, no body
+            continue;
+        }
+        p += 2;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        *len = strcspn(p, " \t\n|&<>;");
+        return p;
+    }
+    return NULL;
+}
+
+/*
+ * read_heredocs - Reads the body of every here-document started on line.
+ * *line_count is advanced by the number of lines read.
+ * Returns 0 on success, or -1 if a delimiter is missing or memory runs out.
+ */
+int read_heredocs(const char *line, FILE *in, int *line_count, int interactive) {
+    const char *p = line;
+    size_t delim_len;
+    while ((p = find_heredoc(p, &delim_len)) != NULL) {
+        if (delim_len == 0) {
+            return -1;
+        }
+        HereDoc *doc = read_body(p, delim_len, in, line_count, interactive);
+        if (doc == NULL) {
+            return -1;
+        }
+        if (heredocs_tail) {
+            heredocs_tail->next = doc;
+        } else {
+            heredocs = doc;
+        }
+        heredocs_tail = doc;
+        p += delim_len;
+    }
+    return 0;
+}
+
+/*
+ * free_heredocs - Frees a list of bodies.
+ */
+void free_heredocs(HereDoc *docs) {
+    while (docs != NULL) {
+        HereDoc *doc = docs;
+        docs = doc->next;
+        free(doc->body);
+        free(doc);
+    }
+}
+
+/*
+ * discard_heredocs - Frees bodies that were not used by the line (for example
+ * after an error or a built-in command).
+ */
+void discard_heredocs() {
+    free_heredocs(heredocs);
+    heredocs = NULL;
+    heredocs_tail = NULL;
+}
+
+/*
+ * take_heredocs - Removes the bodies of the here-documents in text from the
+ * bodies read so far (they were read in the order they appear) and returns them.
+ */
+HereDoc *take_heredocs(const char *text) {
+    HereDoc *taken = NULL, **tail = &taken;
+    const char *p = text;
+    size_t delim_len;
+    while ((p = find_heredoc(p, &delim_len)) != NULL && heredocs != NULL) {
+        *tail = heredocs;
+        heredocs = heredocs->next;
+        tail = &(*tail)->next;
+        *tail = NULL;
+        p += delim_len;
+    }
+    if (heredocs == NULL) {
+        heredocs_tail = NULL;
+    }
+    return taken;
+}
+
+/*
+ * queue_heredocs - Makes copies of docs available to the next command, which
+ * is how a statement in a loop gets its here-documents on every pass.
+ * Returns 0 on success, or -1 if memory runs out.
+ */
+int queue_heredocs(const HereDoc *docs) {
+    for (; docs != NULL; docs = docs->next) {
+        HereDoc *copy = (HereDoc *)calloc(1, sizeof(HereDoc));
+        if (copy == NULL || (docs->len > 0 && (copy->body = (char *)malloc(docs->len)) == NULL)) {
+            free(copy);
+            return -1;
+        }
+        if (docs->len > 0) {
+            memcpy(copy->body, docs->body, docs->len);
+        }
+        copy->len = docs->len;
+        if (heredocs_tail) {
+            heredocs_tail->next = copy;
+        } else {
+            heredocs = copy;
+        }
+        heredocs_tail = copy;
+    }
+    return 0;
+}
+
+/*
+ * document_fd - Returns a readable descriptor positioned at the start of data.
+ */
+static int document_fd(const char *data, size_t len) {
+    int fds[2];
+    if (len <= HEREDOC_PIPE_MAX && pipe(fds) == 0) {
+        // Usually fits in the pipe buffer, so it can be written before the command
+        // starts. The write end is non-blocking in case the buffer is smaller.
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        int result = write_all(fds[1], data, len);
+        int full = (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+        close(fds[1]);
+        if (result == 0) {
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            return fds[0];
+        }
+        close(fds[0]);
+        if (!full) {
+            return -1;
+        }
+    }
+
+#ifdef __linux__
+    int fd = memfd_create("gush-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    // No memfd: fall back to an anonymous (already unlinked) temporary file
+    char path[] = "/tmp/gush-heredoc-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (fd < 0) {
+        return -1;
+    }
+    if (write_all(fd, data, len) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return -1;
+    }
+#ifdef __linux__
+    // The command can read the data but can never change it
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+    return fd;
+}
+
+/*
+ * open_input_documents - Prepares every "<<WORD" and "<<< word" in args and
+ * rewrites them as "<" redirections. Must be called in the shell before fork().
+ * Returns 0 on success, or -1 if a document cannot be prepared.
+ */
+int open_input_documents(char **args) {
+    int count = 0;
+    while (args[count] != NULL) {
+        count++;
+    }
+
+    for (int i = 0; args[i] != NULL; i++) {
+        if (strncmp(args[i], "<<", 2) != 0) {
+            continue;
+        }
+        int here_string = (args[i][2] == '<');
+        char *word = args[i] + (here_string ? 3 : 2);
+        int separate = (*word == '\0');  // "<< EOF" rather than "<<EOF"
+        if (separate) {
+            word = args[i + 1];
+        }
+        if (word == NULL) {
+            release_input_documents();
+            return -1;
+        }
+
+        int fd;
+        if (here_string) {
+            // A here-string is the word followed by a newline
+            size_t len = strlen(word);
+            char *data = (char *)malloc(len + 1);
+            if (data == NULL) {
+                release_input_documents();
+                return -1;
+            }
+            memcpy(data, word, len);
+            data[len] = '\n';
+            fd = document_fd(data, len + 1);
+            free(data);
+        } else {
+            // Bodies were read in the order their commands appear on the line
+            HereDoc *doc = heredocs;
+            if (doc == NULL) {
+                release_input_documents();
+                return -1;
+            }
+            heredocs = doc->next;
+            if (heredocs == NULL) {
+                heredocs_tail = NULL;
+            }
+            fd = document_fd(doc->body, doc->len);
+            free(doc->body);
+            free(doc);
+        }
+
+        InputDocument *d = (InputDocument *)malloc(sizeof(InputDocument));
+        if (fd < 0 || d == NULL || (d->filename = strdup("here-document")) == NULL) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            free(d);
+            release_input_documents();
+            return -1;
+        }
+        d->fd = fd;
+        d->next = pending;
+        pending = d;
+
+        // Rewrite as "< placeholder" for handle_redirection()
+        if (!separate) {
+            if (count + 1 >= MAX_ARG_SIZE) {
+                release_input_documents();
+                return -1;
+            }
+            memmove(&args[i + 2], &args[i + 1], (count - i) * sizeof(char *));
+            count++;
+        }
+        args[i] = "<";
+        args[i + 1] = d->filename;
+        i++;
+    }
+    return 0;
+}
+
+/*
+ * input_document_fd - Returns the descriptor behind a placeholder file name,
+ * or -1 if it names an ordinary file. Called by handle_redirection() in the child.
+ */
+int input_document_fd(const char *filename) {
+    for (InputDocument *d = pending; d != NULL; d = d->next) {
+        if (d->filename == filename) {
+            return d->fd;
+        }
+    }
+    return -1;
+}
+
+/*
+ * release_input_documents - Closes the shell's copies of the descriptors once
+ * the command has been forked (or could not be started).
+ */
+void release_input_documents() {
+    while (pending != NULL) {
+        InputDocument *d = pending;
+        pending = d->next;
+        close(d->fd);
+        free(d->filename);
+        free(d);
+    }
+}
@@ -0,0 +1,33 @@
+//This is the header file for heredoc.c
+#ifndef HEREDOC_H
+#define HEREDOC_H
+
+#include <stdio.h>
+
+// HereDoc structure:
+// The body of a "<<WORD" here-document, read from the input after its command line.
+typedef struct HereDoc {
+    char *body;                      // Lines up to (not including) the delimiter
+    size_t len;                      // Length of body
+    struct HereDoc *next;            // Next here-document of the same line
+} HereDoc;
+
+// InputDocument structure:
+// A here-document or here-string that is ready to be used as a command's stdin.
+typedef struct InputDocument {
+    char *filename;                  // Placeholder stored in the command's args after '<'
+    int fd;                          // Pipe or sealed memfd holding the data
+    struct InputDocument *next;
+} InputDocument;
+
+const char *find_heredoc(const char *text, size_t *len);
+int read_heredocs(const char *line, FILE *in, int *line_count, int interactive);
+void discard_heredocs();
+void free_heredocs(HereDoc *docs);
+HereDoc *take_heredocs(const char *text);
+int queue_heredocs(const HereDoc *docs);
+int open_input_documents(char **args);
+int input_document_fd(const char *filename);
+void release_input_documents();
+
+#endif
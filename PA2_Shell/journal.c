@@ -0,0 +1,269 @@
+/*
+ * journal.c
+ *
+ * Implements the completion journal for batch mode:
+ *
+ *     gush --journal run.log script.txt            record progress
+ *     gush --journal run.log --resume script.txt   skip what already succeeded
+ *
+ * After each script line finishes (together with any here-document or loop
+ * lines it read), one record is appended to the journal:
+ *
+ *     <line> <number of lines> <hash of their text> <exit status>
+ *
+ * Lines that start background jobs or coprocesses are not recorded, because
+ * their work may still be running when the line returns.
+ *
+ * Records are flushed to the kernel right away, so they survive the shell being
+ * killed. To keep the cost low they are only fsync'ed in batches, every
+ * JOURNAL_SYNC_RECORDS records or JOURNAL_SYNC_INTERVAL milliseconds, and when
+ * the shell exits. After a crash at most one batch is lost, and those lines
+ * simply run again.
+ *
+ * With --resume, the text of every recorded line is hashed again first. If it
+ * has changed, the script was edited since the journal was written: this is
+ * reported and every line from there on is run. Otherwise a line is skipped if
+ * the journal records it as successful. Lines with any statement that changes
+ * the shell's own state (cd, path, spool, coproc, variable assignments and for
+ * loops, also inside loop bodies) always run again.
+ */
+
+#include "journal.h"
+#include "utils.h"
+#include "script.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define JOURNAL_HEADER "gush-journal 1\n"
+#define JOURNAL_SYNC_RECORDS 64       // Records written before an fsync
+#define JOURNAL_SYNC_INTERVAL 1000    // Longest time between fsyncs (milliseconds)
+
+static FILE *journal = NULL;          // NULL when no journal is kept
+static JournalEntry *entries = NULL;  // Records of the run being resumed, by line
+static int entry_count = 0;
+static int resuming = 0;              // Still skipping completed lines
+static int skipped = 0;
+static int unsynced = 0;              // Records written since the last fsync
+static long long last_sync = 0;
+
+/*
+ * hash_text - Adds text to a 64-bit FNV-1a hash.
+ */
+static unsigned long long hash_text(unsigned long long hash, const char *text) {
+    for (; *text != '\0'; text++) {
+        hash ^= (unsigned char)*text;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * hash_lines - Hashes input followed by the next extra lines of the script.
+ * If all_text is not NULL, it is set to a copy of all those lines.
+ * Returns -1 if the script ends first or memory runs out.
+ */
+static int hash_lines(FILE *script, const char *input, int extra, unsigned long long *hash,
+                      char **all_text) {
+    char *text = NULL;
+    size_t cap = 0;
+    int result = 0;
+    size_t len = strlen(input);
+    char *all = NULL;
+
+    if (all_text != NULL && (all = strdup(input)) == NULL) {
+        return -1;
+    }
+    *hash = hash_text(14695981039346656037ULL, input);
+    for (int i = 0; i < extra; i++) {
+        ssize_t n = getline(&text, &cap, script);
+        if (n < 0) {
+            result = -1;
+            break;
+        }
+        *hash = hash_text(*hash, text);
+        if (all != NULL) {
+            char *grown = (char *)realloc(all, len + n + 1);
+            if (grown == NULL) {
+                result = -1;
+                break;
+            }
+            all = grown;
+            memcpy(all + len, text, n + 1);
+            len += n;
+        }
+    }
+    free(text);
+    if (result < 0 || all_text == NULL) {
+        free(all);
+    } else {
+        *all_text = all;
+    }
+    return result;
+}
+
+/*
+ * load_entries - Reads the records of an earlier run. A missing journal is
+ * treated as empty. Returns -1 if the file is not a journal.
+ */
+static int load_entries(const char *path) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return (errno == ENOENT) ? 0 : -1;
+    }
+
+    char *text = NULL;
+    size_t cap = 0;
+    ssize_t n = getline(&text, &cap, in);
+    if (n >= 0 && strcmp(text, JOURNAL_HEADER) != 0) {
+        free(text);
+        fclose(in);
+        return -1;
+    }
+    while ((n = getline(&text, &cap, in)) > 0) {
+        int line, lines, status;
+        unsigned long long hash;
+        if (text[n - 1] != '\n' ||
+            sscanf(text, "%d %d %llx %d", &line, &lines, &hash, &status) != 4 ||
+            line <= 0 || lines <= 0) {
+            continue;  // Torn by a crash while it was written
+        }
+        if (line >= entry_count) {
+            int count = line + 1;
+            JournalEntry *grown = (JournalEntry *)realloc(entries, count * sizeof(JournalEntry));
+            if (grown == NULL) {
+                break;
+            }
+            memset(grown + entry_count, 0, (count - entry_count) * sizeof(JournalEntry));
+            entries = grown;
+            entry_count = count;
+        }
+        // A later record for the same line (a re-run after resuming) replaces the earlier one
+        entries[line] = (JournalEntry){lines, hash, status};
+    }
+    free(text);
+    fclose(in);
+    return 0;
+}
+
+/*
+ * sync_journal - Makes the records written so far durable.
+ */
+static void sync_journal() {
+    fflush(journal);
+#ifdef __linux__
+    fdatasync(fileno(journal));
+#else
+    fsync(fileno(journal));
+#endif
+    unsynced = 0;
+    last_sync = monotonic_ns() / 1000000;
+}
+
+/*
+ * journal_finish - Syncs and closes the journal when the shell exits.
+ */
+static void journal_finish() {
+    sync_journal();
+    fclose(journal);
+    journal = NULL;
+    free(entries);
+    entries = NULL;
+    if (skipped > 0) {
+        fprintf(stderr, "journal: skipped %d completed line%s\n", skipped, skipped == 1 ? "" : "s");
+    }
+}
+
+/*
+ * journal_open - Starts recording completed lines in path. With resume set, the
+ * records already in path are loaded first and new ones are appended.
+ * Returns 0 on success, or -1 if the journal cannot be read or created.
+ */
+int journal_open(const char *path, int resume) {
+    if (resume && load_entries(path) < 0) {
+        return -1;
+    }
+    journal = fopen(path, resume ? "a" : "w");
+    if (journal == NULL) {
+        return -1;
+    }
+    fcntl(fileno(journal), F_SETFD, FD_CLOEXEC);
+
+    struct stat st;
+    if (fstat(fileno(journal), &st) == 0 && st.st_size == 0) {
+        fputs(JOURNAL_HEADER, journal);
+    }
+    resuming = resume;
+    sync_journal();
+    atexit(journal_finish);
+    return 0;
+}
+
+/*
+ * journal_skip - Called with the first script line of the next command.
+ * If the run being resumed completed it successfully, the rest of its lines
+ * are read from script, *line is advanced past them and 1 is returned.
+ * Otherwise nothing is read and 0 is returned.
+ */
+int journal_skip(FILE *script, const char *input, int *line) {
+    if (!resuming || *line >= entry_count) {
+        return 0;
+    }
+    JournalEntry *entry = &entries[*line];
+    if (entry->lines == 0) {
+        return 0;  // Not recorded
+    }
+
+    // Any recorded line is checked for edits, whether or not it will be skipped
+    long pos = ftell(script);
+    unsigned long long hash;
+    char *text = NULL;
+    if (hash_lines(script, input, entry->lines - 1, &hash, &text) < 0 || hash != entry->hash) {
+        free(text);
+        fseek(script, pos, SEEK_SET);
+        fprintf(stderr, "journal: line %d was edited since the journal was written, "
+                "running the script from there\n", *line);
+        resuming = 0;
+        return 0;
+    }
+    int run_again = (entry->status != 0 || changes_shell_state(text));
+    free(text);
+    if (run_again) {
+        fseek(script, pos, SEEK_SET);
+        return 0;
+    }
+    *line += entry->lines - 1;
+    skipped++;
+    return 1;
+}
+
+/*
+ * journal_record - Appends the record for a command that started at first_line
+ * (whose text is input) and ended at last_line. start_pos is the script offset
+ * just after first_line, used to hash the rest of its lines.
+ */
+void journal_record(FILE *script, const char *input, int first_line, int last_line,
+                    long start_pos, int status) {
+    if (journal == NULL) {
+        return;
+    }
+    unsigned long long hash;
+    long pos = ftell(script);
+    int result = -1;
+    if (pos >= 0 && fseek(script, start_pos, SEEK_SET) == 0) {
+        result = hash_lines(script, input, last_line - first_line, &hash, NULL);
+        fseek(script, pos, SEEK_SET);
+    }
+    if (result < 0) {
+        return;
+    }
+
+    fprintf(journal, "%d %d %016llx %d\n", first_line, last_line - first_line + 1, hash, status);
+    fflush(journal);  // In the kernel now, so a killed shell does not lose it
+    if (++unsynced >= JOURNAL_SYNC_RECORDS || monotonic_ns() / 1000000 - last_sync >= JOURNAL_SYNC_INTERVAL) {
+        sync_journal();
+    }
+}
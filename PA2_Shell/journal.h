@@ -0,0 +1,21 @@
+//This is the header file for journal.c
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdio.h>
+
+// JournalEntry structure:
+// A completed script line (with its here-document or loop lines) read back
+// from the journal of an earlier run.
+typedef struct JournalEntry {
+    int lines;                       // Number of script lines it covers, 0 if not recorded
+    unsigned long long hash;         // Hash of the text of those lines
+    int status;                      // Exit status, 0 if it succeeded
+} JournalEntry;
+
+int journal_open(const char *path, int resume);
+int journal_skip(FILE *script, const char *input, int *line);
+void journal_record(FILE *script, const char *input, int first_line, int last_line,
+                    long start_pos, int status);
+
+#endif
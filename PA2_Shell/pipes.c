@@ -4,15 +4,26 @@
  * Implements the piping feature for the shell. The execute_piped_commands()
  * function splits a command line (containing the '|' operator) into separate commands,
  * creates pipes to connect the stdout of one command to the stdin of the next, and
- * forks processes to execute each command.
+ * forks processes to execute each command. Children that fail before execve()
+ * leave with _exit() so the shell's stdio buffers are not flushed twice.
  *
  * Up to 4 pipes are supported.
+ *
+ * The line's execution policy applies to every stage, and a stage may begin
+ * with its own "with ..." prefix to override parts of it for that stage.
+ *
+ * Every stage is parsed and its redirections checked before any compressed
+ * output is opened, so an invalid stage leaves the other stages' files intact.
  */
 
 #include "pipes.h"
 #include "utils.h"
 #include "execute.h"  
 #include "redirection.h" 
+#include "policy.h"
+#include "compress.h"
+#include "trace.h"
+#include "heredoc.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,7 +33,7 @@
 
 #define MAX_PIPE_CMDS 5  // Supports up to 4 pipes, i.e. 5 commands
 
-int execute_piped_commands(char *cmd_line) {
+int execute_piped_commands(char *cmd_line, const ExecPolicy *policy) {
     char *cmds[MAX_PIPE_CMDS];
     int num_cmds = 0;
 
@@ -47,80 +58,142 @@ int execute_piped_commands(char *cmd_line) {
         }
     }
 
+    // Parse every stage in the shell, so that compressed redirections can be
+    // started before any stage is forked.
+    char *args[MAX_PIPE_CMDS][MAX_ARG_SIZE];
+    ExecPolicy stage_policies[MAX_PIPE_CMDS];
+    long long parse_start = trace_now();
+    for (int i = 0; i < num_cmds; i++) {
+        // Merge any stage-specific policy prefix into the line's policy
+        stage_policies[i] = *policy;
+        cmds[i] = parse_policy_prefix(cmds[i], &stage_policies[i]);
+        if (cmds[i] == NULL) {
+            release_input_documents();
+            return -1;
+        }
+
+        // Parse the individual command into arguments
+        int k = 0;
+        char *arg = strtok(cmds[i], " \t\n");
+        while (arg != NULL && k < MAX_ARG_SIZE - 1) {
+            args[i][k++] = arg;
+            arg = strtok(NULL, " \t\n");
+        }
+        args[i][k] = NULL;
+
+        if (open_input_documents(args[i]) < 0) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < num_cmds; i++) {
+        if (check_redirections(args[i]) < 0) {
+            release_input_documents();
+            return -1;
+        }
+    }
+    for (int i = 0; i < num_cmds; i++) {
+        if (open_compressed_streams(args[i]) < 0) {
+            release_input_documents();
+            return -1;
+        }
+    }
+    trace_span("parse", parse_start, getpid(), -1);
+
     int pipefds[2 * (num_cmds - 1)];
     for (int i = 0; i < num_cmds - 1; i++) {
         if (pipe(pipefds + i * 2) < 0) {
             print_error();
+            while (--i >= 0) {
+                close(pipefds[i * 2]);
+                close(pipefds[i * 2 + 1]);
+            }
+            cancel_compressed_streams();
+            release_input_documents();
             return -1;
         }
     }
 
     int status;
     pid_t pid;
+    pid_t stage_pids[MAX_PIPE_CMDS];
+    long long stage_starts[MAX_PIPE_CMDS];
     for (int i = 0; i < num_cmds; i++) {
+        stage_starts[i] = trace_now();
         pid = fork();
         if (pid < 0) {
             print_error();
+            release_compressed_streams(0);
+            release_input_documents();
             return -1;
         } else if (pid == 0) {  // Child process
+            long long setup_start = trace_now();
             // If not the first command, redirect stdin to previous pipe's read end
             if (i != 0) {
                 if (dup2(pipefds[(i - 1) * 2], STDIN_FILENO) < 0) {
                     print_error();
-                    exit(1);
+                    _exit(1);
                 }
             }
             // If not the last command, redirect stdout to current pipe's write end
             if (i != num_cmds - 1) {
                 if (dup2(pipefds[i * 2 + 1], STDOUT_FILENO) < 0) {
                     print_error();
-                    exit(1);
+                    _exit(1);
                 }
             }
             // Close all pipe file descriptors in the child process
             for (int j = 0; j < 2 * (num_cmds - 1); j++) {
                 close(pipefds[j]);
             }
-            // Parse the individual command into arguments
-            char *args[MAX_ARG_SIZE];
-            int k = 0;
-            char *arg = strtok(cmds[i], " \t\n");
-            while (arg != NULL && k < MAX_ARG_SIZE - 1) {
-                args[k++] = arg;
-                arg = strtok(NULL, " \t\n");
-            }
-            args[k] = NULL;
-            
             // Handle any redirection in the sub-command.
             // This call will scan args for '<' or '>' and set up redirection,
             // removing the redirection tokens from args.
-            if (handle_redirection(args) < 0) {
+            if (handle_redirection(args[i]) < 0) {
                 print_error();
-                exit(1);
+                _exit(1);
             }
             
             // Locate the executable for the command.
-            char *full_path = find_executable(args[0]);
+            long long lookup_start = trace_now();
+            char *full_path = find_executable(args[i][0]);
+            trace_span("find_executable", lookup_start, getpid(), i);
             if (full_path == NULL) {
                 print_error();
-                exit(1);
+                _exit(1);
+            }
+            // Apply CPU affinity, scheduling and resource limits.
+            if (apply_policy(&stage_policies[i], i) < 0) {
+                _exit(1);
             }
+            trace_span("setup", setup_start, getpid(), i);
+            trace_instant("execve", getpid(), i);
             // Execute the command.
-            execve(full_path, args, NULL);
+            execve(full_path, args[i], NULL);
             print_error();
-            exit(1);
+            _exit(1);
         }
+        trace_span("fork", stage_starts[i], getpid(), i);
+        stage_pids[i] = pid;
     }
     
     // Close all pipe file descriptors in the parent process.
     for (int i = 0; i < 2 * (num_cmds - 1); i++) {
         close(pipefds[i]);
     }
+    release_compressed_streams(0);
+    release_input_documents();
     
     // Wait for all child processes to finish.
+    // Only the stages are waited for, so background jobs are still reaped
+    // (and their output flushed) by check_background_processes().
     for (int i = 0; i < num_cmds; i++) {
-        wait(&status);
+        long long reap_start = trace_now();
+        waitpid(stage_pids[i], &status, 0);
+        trace_span("reap", reap_start, getpid(), i);
+        trace_span("process", stage_starts[i], stage_pids[i], i);
     }
+    last_status = exit_code(status);  // A pipeline reports its last stage
+    wait_compressed_streams();
     
     return 0;
 }
@@ -2,7 +2,8 @@
 #ifndef PIPES_H
 #define PIPES_H
 
+#include "policy.h"
 
-int execute_piped_commands(char *cmd_line);
+int execute_piped_commands(char *cmd_line, const ExecPolicy *policy);
 
 #endif
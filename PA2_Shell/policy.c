@@ -0,0 +1,320 @@
+/*
+ * policy.c
+ *
+ * Implements per-command execution policies for the shell.
+ * A command line (or a single pipeline stage) may start with a prefix such as
+ *
+ *     with cpus=2-5 nice=10 mem=2G cmd | ...
+ *
+ * parse_policy_prefix() strips the prefix and records the options, and
+ * apply_policy() is called in the child after fork() and before execve()
+ * to set the CPU affinity, scheduling class, nice value and resource limits.
+ *
+ * Supported options:
+ *   cpus=LIST    CPUs to run on, e.g. 0,2-5
+ *   spread       Pin each pipeline stage to its own CPU taken from cpus=
+ *   nice=N       Nice value (-20..19)
+ *   sched=CLASS  other, batch, idle, fifo or rr
+ *   prio=N       Real-time priority (1..99, default 1) used with sched=fifo or sched=rr
+ *   mem=SIZE     Address space limit, SIZE may end in K, M, G or T
+ *   time=SECS    CPU time limit in seconds
+ *   nofile=N     Maximum number of open files
+ *   fsize=SIZE   Largest file the command may write
+ */
+
+#define _GNU_SOURCE  // Needed for sched_setaffinity(), SCHED_BATCH and SCHED_IDLE
+
+#include "policy.h"
+#include "utils.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#define NICE_UNSET -100
+
+/*
+ * policy_init - Resets a policy so that every setting is inherited.
+ */
+void policy_init(ExecPolicy *policy) {
+    policy->num_cpus = 0;
+    policy->spread = 0;
+    policy->nice = NICE_UNSET;
+    policy->sched = -1;
+    policy->sched_prio = 0;
+    policy->mem = -1;
+    policy->cputime = -1;
+    policy->nofile = -1;
+    policy->fsize = -1;
+}
+
+/*
+ * parse_number - Parses a non-negative integer with an optional K/M/G/T suffix.
+ * Returns -1 if the string is not a valid number.
+ */
+static long long parse_number(const char *str, int allow_suffix) {
+    char *endptr;
+    errno = 0;
+    long long value = strtoll(str, &endptr, 10);
+    if (endptr == str || value < 0 || errno != 0) {
+        return -1;
+    }
+    if (allow_suffix && *endptr != '\0') {
+        int shift;
+        switch (toupper((unsigned char)*endptr)) {
+            case 'K': shift = 10; break;
+            case 'M': shift = 20; break;
+            case 'G': shift = 30; break;
+            case 'T': shift = 40; break;
+            default: return -1;
+        }
+        if (value > (LLONG_MAX >> shift)) {
+            return -1;  // Too large to represent
+        }
+        value <<= shift;
+        endptr++;
+    }
+    return (*endptr == '\0') ? value : -1;
+}
+
+/*
+ * parse_cpu_list - Parses a list such as "0,2-5" into the policy's CPU array.
+ */
+static int parse_cpu_list(const char *str, ExecPolicy *policy) {
+    const char *p = str;
+    policy->num_cpus = 0;
+
+    while (*p != '\0') {
+        char *endptr;
+        long first = strtol(p, &endptr, 10);
+        long last = first;
+        if (endptr == p || first < 0) {
+            return -1;
+        }
+        p = endptr;
+        if (*p == '-') {
+            p++;
+            last = strtol(p, &endptr, 10);
+            if (endptr == p || last < first) {
+                return -1;
+            }
+            p = endptr;
+        }
+        if (last >= POLICY_MAX_CPUS) {
+            return -1;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (policy->num_cpus < POLICY_MAX_CPUS) {
+                policy->cpus[policy->num_cpus++] = (int)cpu;
+            }
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return -1;
+        }
+    }
+    return policy->num_cpus > 0 ? 0 : -1;
+}
+
+/*
+ * parse_sched - Maps a scheduling class name to its SCHED_* constant.
+ */
+static int parse_sched(const char *name) {
+    if (strcmp(name, "other") == 0) return SCHED_OTHER;
+    if (strcmp(name, "fifo") == 0) return SCHED_FIFO;
+    if (strcmp(name, "rr") == 0) return SCHED_RR;
+#ifdef SCHED_BATCH
+    if (strcmp(name, "batch") == 0) return SCHED_BATCH;
+#endif
+#ifdef SCHED_IDLE
+    if (strcmp(name, "idle") == 0) return SCHED_IDLE;
+#endif
+    return -1;
+}
+
+/*
+ * parse_option - Applies a single "key=value" (or "spread") option to the policy.
+ */
+static int parse_option(char *opt, ExecPolicy *policy) {
+    if (strcmp(opt, "spread") == 0) {
+        policy->spread = 1;
+        return 0;
+    }
+
+    char *value = strchr(opt, '=');
+    if (value == NULL) {
+        return -1;
+    }
+    *value++ = '\0';
+
+    if (strcmp(opt, "cpus") == 0) {
+        return parse_cpu_list(value, policy);
+    }
+    if (strcmp(opt, "nice") == 0) {
+        char *endptr;
+        long nice = strtol(value, &endptr, 10);
+        if (endptr == value || *endptr != '\0' || nice < -20 || nice > 19) {
+            return -1;
+        }
+        policy->nice = (int)nice;
+        return 0;
+    }
+    if (strcmp(opt, "sched") == 0) {
+        policy->sched = parse_sched(value);
+        return policy->sched < 0 ? -1 : 0;
+    }
+    if (strcmp(opt, "prio") == 0) {
+        long long prio = parse_number(value, 0);
+        if (prio < 1 || prio > 99) {
+            return -1;
+        }
+        policy->sched_prio = (int)prio;
+        return 0;
+    }
+
+    long long number = parse_number(value, strcmp(opt, "mem") == 0 || strcmp(opt, "fsize") == 0);
+    if (number < 0) {
+        return -1;
+    }
+    if (strcmp(opt, "mem") == 0) {
+        policy->mem = number;
+    } else if (strcmp(opt, "time") == 0) {
+        policy->cputime = number;
+    } else if (strcmp(opt, "nofile") == 0) {
+        policy->nofile = number;
+    } else if (strcmp(opt, "fsize") == 0) {
+        policy->fsize = number;
+    } else {
+        return -1;  // Unknown option
+    }
+    return 0;
+}
+
+/*
+ * parse_policy_prefix - Strips a leading "with opt=value ..." prefix from cmd.
+ *
+ * Options found are merged into policy, so a pipeline stage can start from a
+ * copy of the line's policy and override parts of it.
+ * Returns a pointer to the command that follows the prefix (cmd itself if there
+ * is no prefix), or NULL if the prefix is malformed or no command follows it.
+ */
+char *parse_policy_prefix(char *cmd, ExecPolicy *policy) {
+    char *p = cmd;
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (strncmp(p, "with", 4) != 0 || !isspace((unsigned char)p[4])) {
+        return cmd;  // No policy prefix
+    }
+    p += 4;
+
+    while (1) {
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0') {
+            return NULL;  // Prefix without a command
+        }
+
+        char *end = p;
+        while (*end != '\0' && !isspace((unsigned char)*end)) {
+            end++;
+        }
+        size_t len = end - p;
+
+        // The first word that is not an option starts the command
+        if (memchr(p, '=', len) == NULL && !(len == 6 && strncmp(p, "spread", 6) == 0)) {
+            return p;
+        }
+
+        char opt[128];
+        if (len >= sizeof(opt)) {
+            return NULL;
+        }
+        memcpy(opt, p, len);
+        opt[len] = '\0';
+        if (parse_option(opt, policy) < 0) {
+            return NULL;
+        }
+        p = end;
+    }
+}
+
+/*
+ * set_limit - Sets both the soft and hard value of a resource limit.
+ */
+static int set_limit(int resource, long long value) {
+    struct rlimit limit;
+    limit.rlim_cur = (rlim_t)value;
+    limit.rlim_max = (rlim_t)value;
+    return setrlimit(resource, &limit);
+}
+
+/*
+ * apply_policy - Applies a policy to the calling process.
+ *
+ * Meant to be called in the child after fork() and before execve().
+ * stage is the position of the command in its pipeline (or its job number on
+ * a background line) and selects the CPU used when "spread" is set.
+ * Prints an error and returns -1 if any setting cannot be applied.
+ */
+int apply_policy(const ExecPolicy *policy, int stage) {
+    if ((policy->mem >= 0 && set_limit(RLIMIT_AS, policy->mem) < 0) ||
+        (policy->cputime >= 0 && set_limit(RLIMIT_CPU, policy->cputime) < 0) ||
+        (policy->nofile >= 0 && set_limit(RLIMIT_NOFILE, policy->nofile) < 0) ||
+        (policy->fsize >= 0 && set_limit(RLIMIT_FSIZE, policy->fsize) < 0)) {
+        print_error();
+        return -1;
+    }
+
+    if (policy->sched >= 0) {
+#ifdef __linux__
+        struct sched_param param;
+        param.sched_priority = 0;
+        if (policy->sched == SCHED_FIFO || policy->sched == SCHED_RR) {
+            // Real-time classes need a priority of at least 1
+            param.sched_priority = (policy->sched_prio > 0) ? policy->sched_prio : 1;
+        }
+        if (sched_setscheduler(0, policy->sched, &param) < 0) {
+            print_error();
+            return -1;
+        }
+#else
+        print_error();  // Scheduling classes are only available on Linux
+        return -1;
+#endif
+    }
+
+    if (policy->nice != NICE_UNSET && setpriority(PRIO_PROCESS, 0, policy->nice) < 0) {
+        print_error();
+        return -1;
+    }
+
+    if (policy->num_cpus > 0) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (policy->spread) {
+            CPU_SET(policy->cpus[stage % policy->num_cpus], &set);
+        } else {
+            for (int i = 0; i < policy->num_cpus; i++) {
+                CPU_SET(policy->cpus[i], &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            print_error();
+            return -1;
+        }
+#else
+        (void)stage;
+        print_error();  // CPU affinity is only available on Linux
+        return -1;
+#endif
+    }
+    return 0;
+}
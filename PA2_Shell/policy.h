@@ -0,0 +1,27 @@
+//This is the header file for policy.c
+#ifndef POLICY_H
+#define POLICY_H
+
+#define POLICY_MAX_CPUS 64   // Highest CPU index accepted in a cpus= list is 63
+
+// ExecPolicy structure:
+// Resource and scheduling settings applied to a child between fork() and execve().
+// A field left at its "unset" value (-1 or 0 CPUs) leaves the inherited setting alone.
+typedef struct ExecPolicy {
+    int cpus[POLICY_MAX_CPUS];   // CPUs the command may run on (cpus=2-5,7)
+    int num_cpus;                // Number of entries in cpus, 0 = inherit
+    int spread;                  // Pin each pipeline stage to its own CPU from cpus
+    int nice;                    // Nice value (nice=10), -100 = inherit
+    int sched;                   // Scheduling class (sched=batch), -1 = inherit
+    int sched_prio;              // Real-time priority for sched=fifo/rr (prio=N), 0 if unset
+    long long mem;               // Address space limit in bytes (mem=2G), -1 = inherit
+    long long cputime;           // CPU time limit in seconds (time=60), -1 = inherit
+    long long nofile;            // Open file limit (nofile=256), -1 = inherit
+    long long fsize;             // Largest file the command may write (fsize=1G), -1 = inherit
+} ExecPolicy;
+
+void policy_init(ExecPolicy *policy);
+char *parse_policy_prefix(char *cmd, ExecPolicy *policy);
+int apply_policy(const ExecPolicy *policy, int stage);
+
+#endif
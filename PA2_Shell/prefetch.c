@@ -0,0 +1,368 @@
+/*
+ * prefetch.c
+ *
+ * Implements lookahead prefetching for batch mode. While a line runs, the
+ * shell reads the next GUSH_PREFETCH lines of the script (16 by default,
+ * 0 turns prefetching off) from a second stream, resolves the executable of
+ * every command with find_executable() and notes every "<" input file. A
+ * prefetch thread then asks the kernel to read those files into the page
+ * cache (posix_fadvise(WILLNEED) and readahead()), so on a cold cache the
+ * disk reads overlap with the command that is running instead of stalling
+ * the next fork and exec. The bodies of here-documents are skipped, since they
+ * are data rather than commands.
+ *
+ * With GUSH_PREFETCH_STATS set, counters are printed to stderr when the shell
+ * exits. Read time is "hidden" when a file was prefetched before its line was
+ * reached, and "late" when the line was already running.
+ */
+
+#define _GNU_SOURCE  // Needed for readahead() and gettid()
+
+#include "prefetch.h"
+#include "execute.h"
+#include "heredoc.h"
+#include "trace.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PREFETCH_DEFAULT_DEPTH 16     // Lines read ahead of the running line
+#define PREFETCH_MAX_DEPTH 1024
+#define PREFETCH_QUEUE 256            // Requests waiting for the thread
+#define PREFETCH_SEEN 4096            // Hash slots for files already prefetched
+#define PREFETCH_DELIMS 16            // Here-document bodies waiting to be skipped
+
+static FILE *ahead = NULL;            // Second stream on the script, NULL when disabled
+static int ahead_line = 0;            // Lines read by the lookahead
+static int depth = 0;
+static int current_line = 0;          // Line the shell is running (read by the thread)
+static char *delims[PREFETCH_DELIMS]; // Delimiters of the bodies the lookahead is in, in order
+static int delim_count = 0;
+static unsigned long seen[PREFETCH_SEEN];
+
+static PrefetchRequest queue[PREFETCH_QUEUE];
+static int queue_head = 0, queue_count = 0;
+static int stop_thread = 0;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+
+// Counters for GUSH_PREFETCH_STATS
+static unsigned long lines_scanned = 0;
+static unsigned long files_queued = 0;
+static unsigned long files_dropped = 0;   // Queue was full
+static unsigned long files_read = 0;
+static unsigned long long bytes_read = 0;
+static unsigned long long bytes_cold = 0; // Not in the page cache before prefetching
+static long long hidden_ns = 0;
+static long long late_ns = 0;
+static unsigned long files_late = 0;
+
+#ifdef __linux__
+/*
+ * cold_bytes - Returns how much of the file is not in the page cache.
+ */
+static unsigned long long cold_bytes(int fd, size_t size) {
+    long page = sysconf(_SC_PAGESIZE);
+    size_t pages = (size + page - 1) / page;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    unsigned char *vec = (unsigned char *)malloc(pages);
+    unsigned long long cold = 0;
+    if (vec != NULL && mincore(map, size, vec) == 0) {
+        for (size_t i = 0; i < pages; i++) {
+            if (!(vec[i] & 1)) {
+                cold += page;
+            }
+        }
+    }
+    free(vec);
+    munmap(map, size);
+    return cold;
+}
+
+/*
+ * prefetch_file - Reads one file into the page cache and updates the counters.
+ */
+static void prefetch_file(const PrefetchRequest *req) {
+    int fd = open(req->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    unsigned long long cold = cold_bytes(fd, st.st_size);
+    long long trace_start = trace_now();
+    long long start = monotonic_ns();
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    readahead(fd, 0, st.st_size);  // Blocks while the pages are read
+    long long elapsed = monotonic_ns() - start;
+    // On its own track: its spans overlap the shell's fork and reap spans
+    trace_span("prefetch", trace_start, gettid(), -1);
+    close(fd);
+
+    pthread_mutex_lock(&queue_lock);
+    files_read++;
+    bytes_read += st.st_size;
+    bytes_cold += cold;
+    if (__atomic_load_n(&current_line, __ATOMIC_RELAXED) < req->line) {
+        hidden_ns += elapsed;  // Finished before its line started
+    } else {
+        late_ns += elapsed;
+        files_late++;
+    }
+    pthread_mutex_unlock(&queue_lock);
+}
+#endif
+
+/*
+ * prefetch_thread - Takes requests off the queue until the shell exits.
+ */
+static void *prefetch_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&queue_lock);
+    while (1) {
+        while (queue_count == 0 && !stop_thread) {
+            pthread_cond_wait(&queue_ready, &queue_lock);
+        }
+        if (stop_thread) {
+            break;
+        }
+        PrefetchRequest req = queue[queue_head];
+        queue_head = (queue_head + 1) % PREFETCH_QUEUE;
+        queue_count--;
+        pthread_mutex_unlock(&queue_lock);
+#ifdef __linux__
+        prefetch_file(&req);
+#endif
+        free(req.path);
+        pthread_mutex_lock(&queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+    return NULL;
+}
+
+/*
+ * queue_file - Hands a file to the prefetch thread unless it was queued before.
+ */
+static void queue_file(const char *path, int line) {
+    unsigned long hash = 5381;
+    for (const char *p = path; *p; p++) {
+        hash = hash * 33 + (unsigned char)*p;
+    }
+    hash |= 1;  // 0 marks an empty slot
+    size_t slot = hash % PREFETCH_SEEN;
+    for (int probes = 0; seen[slot] != 0; probes++) {
+        if (seen[slot] == hash || probes == PREFETCH_SEEN) {
+            return;  // Already prefetched (or the table is full)
+        }
+        slot = (slot + 1) % PREFETCH_SEEN;
+    }
+
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&queue_lock);
+    if (queue_count == PREFETCH_QUEUE) {
+        files_dropped++;
+        pthread_mutex_unlock(&queue_lock);
+        free(copy);
+        return;
+    }
+    seen[slot] = hash;
+    queue[(queue_head + queue_count) % PREFETCH_QUEUE] = (PrefetchRequest){copy, line};
+    queue_count++;
+    files_queued++;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+/*
+ * scan_line - Finds the executables and input files used by one script line.
+ * Words containing variables are skipped, since their values are not known yet.
+ */
+static void scan_line(char *text, int line) {
+    char *saveptr;
+    for (char *cmd = strtok_r(text, "|;&\n", &saveptr); cmd != NULL;
+         cmd = strtok_r(NULL, "|;&\n", &saveptr)) {
+        int found_command = 0, in_policy = 0;
+        char *word_saveptr;
+        for (char *word = strtok_r(cmd, " \t", &word_saveptr); word != NULL;
+             word = strtok_r(NULL, " \t", &word_saveptr)) {
+            if (word[0] == '<') {
+                if (word[1] == '<' || word[1] == '&') {
+                    continue;  // Here-document or coprocess, nothing on disk
+                }
+                char *file = (word[1] != '\0') ? word + 1 : strtok_r(NULL, " \t", &word_saveptr);
+                if (file != NULL && strchr(file, '$') == NULL) {
+                    queue_file(file, line);
+                }
+                continue;
+            }
+            if (word[0] == '>') {
+                if (word[strspn(word, ">")] == '\0') {
+                    strtok_r(NULL, " \t", &word_saveptr);  // Output file, nothing to read
+                }
+                continue;
+            }
+            if (found_command) {
+                continue;
+            }
+            if (strcmp(word, "for") == 0) {
+                break;  // The rest is the loop's word list
+            }
+            if (strcmp(word, "with") == 0) {
+                in_policy = 1;
+                continue;
+            }
+            if (strchr(word, '=') != NULL || (in_policy && strcmp(word, "spread") == 0) ||
+                strcmp(word, "while") == 0 || strcmp(word, "do") == 0 ||
+                strcmp(word, "done") == 0) {
+                continue;  // Policy option, assignment or loop keyword
+            }
+            found_command = 1;
+            if (strchr(word, '$') == NULL) {
+                char *full_path = find_executable(word);
+                if (full_path != NULL) {
+                    queue_file(full_path, line);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * skip_body_line - Returns 1 if text is inside a here-document body (or ends
+ * one), so it must not be scanned. Otherwise notes the bodies text starts.
+ */
+static int skip_body_line(const char *text) {
+    if (delim_count > 0) {
+        size_t len = strcspn(text, "\n");
+        if (strlen(delims[0]) == len && strncmp(text, delims[0], len) == 0) {
+            free(delims[0]);
+            delim_count--;
+            memmove(&delims[0], &delims[1], delim_count * sizeof(char *));
+        }
+        return 1;
+    }
+
+    const char *p = text;
+    size_t len;
+    while ((p = find_heredoc(p, &len)) != NULL && delim_count < PREFETCH_DELIMS) {
+        if (len > 0 && (delims[delim_count] = strndup(p, len)) != NULL) {
+            delim_count++;
+        }
+        p += len;
+    }
+    return 0;
+}
+
+/*
+ * prefetch_advance - Called before each script line runs. Reads the lookahead
+ * up to depth lines past line and queues what those lines will need.
+ */
+void prefetch_advance(int line) {
+    if (ahead == NULL) {
+        return;
+    }
+    __atomic_store_n(&current_line, line, __ATOMIC_RELAXED);
+
+    char *text = NULL;
+    size_t cap = 0;
+    while (ahead_line < line + depth) {
+        if (getline(&text, &cap, ahead) < 0) {
+            fclose(ahead);
+            ahead = NULL;
+            break;
+        }
+        ahead_line++;
+        if (skip_body_line(text)) {
+            continue;
+        }
+        lines_scanned++;
+        scan_line(text, ahead_line);
+    }
+    free(text);
+}
+
+/*
+ * prefetch_finish - Stops the prefetch thread when the shell exits and prints
+ * the counters if GUSH_PREFETCH_STATS is set.
+ */
+static void prefetch_finish() {
+    pthread_mutex_lock(&queue_lock);
+    stop_thread = 1;
+    pthread_cond_signal(&queue_ready);
+    pthread_mutex_unlock(&queue_lock);
+    pthread_join(worker, NULL);
+    while (queue_count > 0) {
+        free(queue[queue_head].path);
+        queue_head = (queue_head + 1) % PREFETCH_QUEUE;
+        queue_count--;
+    }
+    if (ahead != NULL) {
+        fclose(ahead);
+        ahead = NULL;
+    }
+    while (delim_count > 0) {
+        free(delims[--delim_count]);
+    }
+
+    const char *stats = getenv("GUSH_PREFETCH_STATS");
+    if (stats != NULL && *stats != '\0') {
+        fprintf(stderr, "prefetch: %lu lines scanned, %lu files queued (%lu dropped), "
+                "%lu read (%llu KB, %llu KB not cached)\n"
+                "prefetch: %.3f ms of reads hidden, %.3f ms late (%lu files)\n",
+                lines_scanned, files_queued, files_dropped, files_read,
+                bytes_read / 1024, bytes_cold / 1024,
+                hidden_ns / 1e6, late_ns / 1e6, files_late);
+    }
+}
+
+/*
+ * prefetch_init - Starts lookahead prefetching for a batch file, unless
+ * GUSH_PREFETCH is 0.
+ */
+void prefetch_init(const char *filename) {
+#ifdef __linux__
+    depth = PREFETCH_DEFAULT_DEPTH;
+    const char *value = getenv("GUSH_PREFETCH");
+    if (value != NULL && *value != '\0') {
+        char *endptr;
+        long n = strtol(value, &endptr, 10);
+        if (*endptr == '\0' && n >= 0) {
+            depth = (n > PREFETCH_MAX_DEPTH) ? PREFETCH_MAX_DEPTH : (int)n;
+        }
+    }
+    if (depth == 0) {
+        return;
+    }
+
+    ahead = fopen(filename, "r");
+    if (ahead == NULL) {
+        return;  // Batch mode reports the error itself
+    }
+    fcntl(fileno(ahead), F_SETFD, FD_CLOEXEC);
+    if (pthread_create(&worker, NULL, prefetch_thread, NULL) != 0) {
+        fclose(ahead);
+        ahead = NULL;
+        return;
+    }
+    atexit(prefetch_finish);
+#else
+    (void)filename;  // posix_fadvise() and readahead() are Linux-only here
+#endif
+}
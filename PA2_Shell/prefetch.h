@@ -0,0 +1,15 @@
+//This is the header file for prefetch.c
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+// PrefetchRequest structure:
+// An executable or input file found by the lookahead, waiting for the prefetch thread.
+typedef struct PrefetchRequest {
+    char *path;                      // File to read into the page cache
+    int line;                        // Script line that will use it
+} PrefetchRequest;
+
+void prefetch_init(const char *filename);
+void prefetch_advance(int line);
+
+#endif
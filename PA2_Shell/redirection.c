@@ -9,19 +9,68 @@
  *
  * If multiple redirection operators or multiple filenames are detected, it
  * prints an error.
+ *
+ * Targets ending in a compression suffix were already opened by the shell
+ * (see compress.c); for those the command's end of the stream pipe is used.
+ * Here-documents and here-strings arrive as '<' with a placeholder name
+ * (see heredoc.c) and use the descriptor prepared for them.
+ * ">&NAME" and "<&NAME" connect stdout or stdin to the coprocess NAME
+ * (see the coproc built-in).
+ *
+ * check_redirections() runs the same checks in the shell before anything is
+ * opened, so a command that is going to fail does not truncate its outputs
+ * (or those of the other stages of its pipeline).
  */
 
 #include "redirection.h"
 #include "utils.h"
+#include "compress.h"
+#include "heredoc.h"
+#include "background.h"
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
 
+/*
+ * check_redirections - Checks the redirections in args without changing them:
+ * at most one input and one output, each with a target, every input file
+ * readable and every coprocess running. Returns 0 if they are valid, or -1.
+ */
+int check_redirections(char **args) {
+    int redirect_in = 0, redirect_out = 0;
+
+    for (int i = 0; args[i] != NULL; i++) {
+        int coproc = (strncmp(args[i], "<&", 2) == 0 || strncmp(args[i], ">&", 2) == 0);
+        if (strcmp(args[i], "<") != 0 && strcmp(args[i], ">") != 0 && !coproc) {
+            continue;
+        }
+        int output = (args[i][0] == '>');
+        char *target = (coproc && args[i][2] != '\0') ? args[i] + 2 : args[++i];
+        if (target == NULL || (output ? redirect_out : redirect_in)) {
+            return -1;
+        }
+        if (output) {
+            redirect_out = 1;
+        } else {
+            redirect_in = 1;
+        }
+        if (coproc) {
+            if (coproc_fd(target, output) < 0) {
+                return -1;
+            }
+        } else if (!output && input_document_fd(target) < 0 && access(target, R_OK) < 0) {
+            return -1;  // Input file missing or unreadable
+        }
+    }
+    return 0;
+}
+
 int handle_redirection(char **args) {
     int i = 0;
     int redirect_in = 0, redirect_out = 0;
     char *infile = NULL, *outfile = NULL;
+    int coproc_in = -1, coproc_out = -1;  // Coprocess pipes to use instead of files
     
     // Loop through the argument list to search for redirection operators
     while (args[i] != NULL) {
@@ -61,12 +110,54 @@ int handle_redirection(char **args) {
             args[j + 1] = NULL;
             continue;
         }
+        else if (strncmp(args[i], "<&", 2) == 0 || strncmp(args[i], ">&", 2) == 0) {
+            // "<&NAME" reads the coprocess's output, ">&NAME" writes to its input
+            int output = (args[i][0] == '>');
+            int removed = (args[i][2] == '\0') ? 2 : 1;  // "<& NAME" or "<&NAME"
+            char *name = (removed == 2) ? args[i + 1] : args[i] + 2;
+            if (name == NULL || (output ? redirect_out : redirect_in)) {
+                print_error();
+                return -1;
+            }
+            int fd = coproc_fd(name, output);
+            if (fd < 0) {
+                print_error();  // No such coprocess (or its input was closed)
+                return -1;
+            }
+            if (output) {
+                redirect_out = 1;
+                coproc_out = fd;
+            } else {
+                redirect_in = 1;
+                coproc_in = fd;
+            }
+            // Remove the operator and name from the args list
+            int j = i;
+            while (args[j + removed] != NULL) {
+                args[j] = args[j + removed];
+                j++;
+            }
+            while (j < i + removed) {
+                args[j++] = NULL;
+            }
+            args[j] = NULL;
+            continue;
+        }
         i++;
     }
     
     // If input redirection is requested, open the file for reading.
     if (redirect_in) {
-        int fd_in = open(infile, O_RDONLY);
+        int fd_in = coproc_in;
+        if (fd_in < 0) {
+            fd_in = input_document_fd(infile);
+        }
+        if (fd_in < 0) {
+            fd_in = compressed_stream_fd(infile, 0);
+        }
+        if (fd_in < 0) {
+            fd_in = open(infile, O_RDONLY);
+        }
         if (fd_in < 0) {
             print_error();
             return -1;
@@ -81,7 +172,13 @@ int handle_redirection(char **args) {
     
     // If output redirection is requested, open (or create) the file for writing.
     if (redirect_out) {
-        int fd_out = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int fd_out = coproc_out;
+        if (fd_out < 0) {
+            fd_out = compressed_stream_fd(outfile, 1);
+        }
+        if (fd_out < 0) {
+            fd_out = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
         if (fd_out < 0) {
             print_error();
             return -1;
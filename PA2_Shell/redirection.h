@@ -3,6 +3,7 @@
 #define REDIRECTION_H
 
 
+int check_redirections(char **args);
 int handle_redirection(char **args);
 
 #endif
@@ -0,0 +1,510 @@
+/*
+ * script.c
+ *
+ * Implements shell variables and loops:
+ *
+ *     dir=testDir
+ *     for x in A B C; do mkdir -p $dir/$x; done
+ *     while test -e lock.file
+ *     do
+ *         sleep 1
+ *     done
+ *
+ * Statements are separated by newlines or ';'. A line that opens a for/while
+ * loop is read together with its continuation lines up to the matching "done",
+ * parsed once into a tree of ScriptNodes, and then run. Loop bodies are never
+ * re-read or re-parsed, only their variables are expanded on each pass.
+ *
+ * $name, ${name} and $? (exit status of the last command) are expanded in every
+ * command. Names not set in the shell are looked up in the environment.
+ * Here-document bodies (also those inside a loop) are read with the lines of
+ * the loop, kept with their statement, and fed to it again on every pass.
+ */
+
+#include "script.h"
+#include "execute.h"
+#include "utils.h"
+#include "heredoc.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+static ShellVar *vars = NULL;  // Head of the linked list of shell variables
+
+/*
+ * name_length - Returns the length of the identifier at the start of str.
+ */
+static size_t name_length(const char *str) {
+    size_t len = 0;
+    if (!isalpha((unsigned char)str[0]) && str[0] != '_') {
+        return 0;
+    }
+    while (isalnum((unsigned char)str[len]) || str[len] == '_') {
+        len++;
+    }
+    return len;
+}
+
+/*
+ * get_var - Looks up a variable, falling back to the environment.
+ */
+static const char *get_var(const char *name, size_t len) {
+    for (ShellVar *v = vars; v != NULL; v = v->next) {
+        if (strlen(v->name) == len && strncmp(v->name, name, len) == 0) {
+            return v->value;
+        }
+    }
+    char env_name[256];
+    if (len < sizeof(env_name)) {
+        memcpy(env_name, name, len);
+        env_name[len] = '\0';
+        return getenv(env_name);
+    }
+    return NULL;
+}
+
+/*
+ * set_var - Creates or updates a shell variable.
+ */
+static void set_var(const char *name, const char *value) {
+    for (ShellVar *v = vars; v != NULL; v = v->next) {
+        if (strcmp(v->name, name) == 0) {
+            char *copy = strdup(value);
+            if (copy != NULL) {
+                free(v->value);
+                v->value = copy;
+            }
+            return;
+        }
+    }
+    ShellVar *v = (ShellVar *)malloc(sizeof(ShellVar));
+    if (!v) {
+        perror("malloc failed");
+        return;
+    }
+    v->name = strdup(name);
+    v->value = strdup(value);
+    v->next = vars;
+    vars = v;
+}
+
+/*
+ * expand - Copies src to dst, replacing $name, ${name} and $?.
+ * Returns -1 if the result does not fit or a ${ is not closed.
+ */
+static int expand(const char *src, char *dst, size_t size) {
+    size_t n = 0;
+    while (*src != '\0') {
+        const char *value = NULL;
+        char status[16];
+
+        if (*src != '$') {
+            if (n + 1 >= size) {
+                return -1;
+            }
+            dst[n++] = *src++;
+            continue;
+        }
+        if (src[1] == '?') {
+            snprintf(status, sizeof(status), "%d", last_status);
+            value = status;
+            src += 2;
+        } else if (src[1] == '{') {
+            const char *end = strchr(src + 2, '}');
+            if (end == NULL) {
+                return -1;
+            }
+            value = get_var(src + 2, end - (src + 2));
+            src = end + 1;
+        } else if (name_length(src + 1) > 0) {
+            size_t len = name_length(src + 1);
+            value = get_var(src + 1, len);
+            src += 1 + len;
+        } else {
+            value = "$";  // A lone '$' is kept as is
+            src++;
+        }
+
+        if (value != NULL) {
+            size_t len = strlen(value);
+            if (n + len >= size) {
+                return -1;
+            }
+            memcpy(dst + n, value, len);
+            n += len;
+        }
+    }
+    dst[n] = '\0';
+    return 0;
+}
+
+/*
+ * run_statement - Runs a simple statement: a variable assignment or a command
+ * with the here-document bodies docs.
+ */
+static void run_statement(const char *text, const HereDoc *docs) {
+    char buffer[MAX_INPUT_SIZE];
+
+    // name=value (a single word) assigns a variable
+    size_t len = name_length(text);
+    if (len > 0 && text[len] == '=' && strpbrk(text, " \t") == NULL) {
+        char name[256];
+        if (len >= sizeof(name) || expand(text + len + 1, buffer, sizeof(buffer)) < 0) {
+            print_error();
+            last_status = 1;
+            return;
+        }
+        memcpy(name, text, len);
+        name[len] = '\0';
+        set_var(name, buffer);
+        last_status = 0;
+        return;
+    }
+
+    if (expand(text, buffer, sizeof(buffer)) < 0 || queue_heredocs(docs) < 0) {
+        print_error();
+        discard_heredocs();
+        last_status = 1;
+        return;
+    }
+    execute_command(buffer);
+    discard_heredocs();  // Not used if the command failed before starting
+}
+
+/*
+ * run_nodes - Runs a list of parsed statements.
+ */
+static void run_nodes(ScriptNode *node) {
+    for (; node != NULL; node = node->next) {
+        if (node->type == NODE_COMMAND) {
+            run_statement(node->text, node->docs);
+        } else if (node->type == NODE_FOR) {
+            // The word list is expanded once, when the loop starts
+            char words[MAX_INPUT_SIZE];
+            if (expand(node->text, words, sizeof(words)) < 0) {
+                print_error();
+                last_status = 1;
+                continue;
+            }
+            char *saveptr;
+            char *word = strtok_r(words, " \t", &saveptr);
+            while (word != NULL) {
+                set_var(node->var, word);
+                run_nodes(node->body);
+                word = strtok_r(NULL, " \t", &saveptr);
+            }
+        } else {
+            while (1) {
+                run_statement(node->text, node->docs);
+                if (last_status != 0) {
+                    break;
+                }
+                run_nodes(node->body);
+            }
+        }
+    }
+}
+
+/*
+ * free_nodes - Frees a list of parsed statements.
+ */
+static void free_nodes(ScriptNode *node) {
+    while (node != NULL) {
+        ScriptNode *next = node->next;
+        free_nodes(node->body);
+        free_heredocs(node->docs);
+        free(node->text);
+        free(node->var);
+        free(node);
+        node = next;
+    }
+}
+
+/*
+ * starts_with_keyword - Checks whether a statement starts with the given word.
+ */
+static int starts_with_keyword(const char *stmt, const char *word) {
+    size_t len = strlen(word);
+    return strncmp(stmt, word, len) == 0 &&
+           (stmt[len] == '\0' || isspace((unsigned char)stmt[len]));
+}
+
+/*
+ * split_statements - Splits text on newlines and ';' into trimmed statements.
+ * "do cmd" is split into "do" and "cmd". Returns the number of statements
+ * added to *stmts (which is grown as needed), or -1 if memory runs out.
+ */
+static int split_statements(const char *text, char ***stmts, int count, int *cap) {
+    char *copy = strdup(text);
+    if (copy == NULL) {
+        return -1;
+    }
+    char *saveptr;
+    char *part = strtok_r(copy, ";\n", &saveptr);
+    while (part != NULL) {
+        char *stmt = trim(part);
+        while (*stmt != '\0') {
+            if (count + 1 > *cap) {
+                *cap = (*cap == 0) ? 16 : *cap * 2;
+                char **grown = (char **)realloc(*stmts, *cap * sizeof(char *));
+                if (grown == NULL) {
+                    free(copy);
+                    return -1;
+                }
+                *stmts = grown;
+            }
+            char *rest = "";
+            if (starts_with_keyword(stmt, "do") && stmt[2] != '\0') {
+                stmt[2] = '\0';
+                rest = trim(stmt + 3);
+            }
+            (*stmts)[count++] = strdup(stmt);
+            stmt = rest;
+        }
+        part = strtok_r(NULL, ";\n", &saveptr);
+    }
+    free(copy);
+    return count;
+}
+
+/*
+ * block_depth - Returns how many loops text opens minus how many it closes.
+ */
+static int block_depth(const char *text) {
+    char **stmts = NULL;
+    int cap = 0;
+    int count = split_statements(text, &stmts, 0, &cap);
+    int depth = 0;
+    for (int i = 0; i < count; i++) {
+        if (starts_with_keyword(stmts[i], "for") || starts_with_keyword(stmts[i], "while")) {
+            depth++;
+        } else if (strcmp(stmts[i], "done") == 0) {
+            depth--;
+        }
+        free(stmts[i]);
+    }
+    free(stmts);
+    return depth;
+}
+
+/*
+ * parse_list - Parses statements into nodes, up to a "done" when in_loop is set.
+ * Sets *error on a syntax error.
+ */
+static ScriptNode *parse_list(char **stmts, int count, int *pos, int in_loop, int *error) {
+    ScriptNode *head = NULL, *tail = NULL;
+
+    while (*pos < count && !*error) {
+        char *stmt = stmts[(*pos)++];
+        if (strcmp(stmt, "done") == 0) {
+            if (!in_loop) {
+                *error = 1;
+            }
+            return head;
+        }
+
+        ScriptNode *node = (ScriptNode *)calloc(1, sizeof(ScriptNode));
+        if (node == NULL) {
+            *error = 1;
+            break;
+        }
+        if (tail) {
+            tail->next = node;
+        } else {
+            head = node;
+        }
+        tail = node;
+
+        if (strcmp(stmt, "do") == 0) {
+            *error = 1;  // "do" without a loop
+        } else if (starts_with_keyword(stmt, "for")) {
+            // for VAR in WORDS
+            char *p = trim(stmt + 3);
+            size_t len = name_length(p);
+            char *words = trim(p + len);
+            if (len == 0 || !starts_with_keyword(words, "in")) {
+                *error = 1;
+                break;
+            }
+            node->type = NODE_FOR;
+            node->var = strndup(p, len);
+            node->text = strdup(trim(words + 2));
+        } else if (starts_with_keyword(stmt, "while")) {
+            node->type = NODE_WHILE;
+            node->text = strdup(trim(stmt + 5));
+            if (node->text == NULL || node->text[0] == '\0') {
+                *error = 1;
+                break;
+            }
+            node->docs = take_heredocs(node->text);
+        } else {
+            node->type = NODE_COMMAND;
+            node->text = strdup(stmt);
+            if (node->text == NULL) {
+                *error = 1;
+                break;
+            }
+            node->docs = take_heredocs(node->text);
+            continue;
+        }
+
+        // A loop header must be followed by "do", the body and "done"
+        if (*pos >= count || strcmp(stmts[*pos], "do") != 0) {
+            *error = 1;
+            break;
+        }
+        (*pos)++;
+        node->body = parse_list(stmts, count, pos, 1, error);
+        if (node->body == NULL && !*error && (*pos > count || strcmp(stmts[*pos - 1], "done") != 0)) {
+            *error = 1;  // Input ended before "done"
+        }
+    }
+
+    if (in_loop) {
+        *error = 1;  // Ran out of statements before "done"
+    }
+    return head;
+}
+
+/*
+ * statement_changes_state - Checks one statement for an assignment, a for loop
+ * or a cd, path, spool or coproc built-in (also after a "with ..." prefix).
+ */
+static int statement_changes_state(const char *stmt) {
+    if (starts_with_keyword(stmt, "for")) {
+        return 1;  // Sets its loop variable
+    }
+    if (starts_with_keyword(stmt, "while")) {
+        stmt += 5;  // The condition is a command like any other
+    }
+    while (isspace((unsigned char)*stmt)) {
+        stmt++;
+    }
+    if (starts_with_keyword(stmt, "with")) {
+        // Skip the policy options
+        stmt += 4;
+        while (1) {
+            while (isspace((unsigned char)*stmt)) {
+                stmt++;
+            }
+            size_t len = strcspn(stmt, " \t");
+            if (len == 0 || (memchr(stmt, '=', len) == NULL &&
+                             !(len == 6 && strncmp(stmt, "spread", 6) == 0))) {
+                break;
+            }
+            stmt += len;
+        }
+    }
+
+    size_t len = name_length(stmt);
+    if (len > 0 && stmt[len] == '=') {
+        return 1;
+    }
+    const char *builtins[] = {"cd", "path", "spool", "coproc", NULL};
+    for (int i = 0; builtins[i] != NULL; i++) {
+        if (starts_with_keyword(stmt, builtins[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * changes_shell_state - Checks whether any statement in text (which may span
+ * several lines, e.g. a whole loop) changes the shell itself, so it must run
+ * again for the lines after it to behave the same.
+ */
+int changes_shell_state(const char *text) {
+    char **stmts = NULL;
+    int cap = 0;
+    int count = split_statements(text, &stmts, 0, &cap);
+    if (count < 0) {
+        return 1;  // Out of memory: assume it does
+    }
+    int result = 0;
+    for (int i = 0; i < count; i++) {
+        if (!result && statement_changes_state(stmts[i])) {
+            result = 1;
+        }
+        free(stmts[i]);
+    }
+    free(stmts);
+    return result;
+}
+
+/*
+ * run_script_line - Runs one line of input. If the line opens a loop, the rest
+ * of the loop is read from in (with a "> " prompt when interactive) and *line is
+ * advanced by the number of extra lines read.
+ * Returns 0 on success, or -1 on a syntax error or unterminated loop.
+ */
+int run_script_line(char *input, FILE *in, int *line, int interactive) {
+    size_t len = strlen(input);
+    size_t cap = len + 1;
+    char *text = (char *)malloc(cap);
+    if (text == NULL) {
+        return -1;
+    }
+    memcpy(text, input, cap);
+
+    // Keep reading until every loop opened so far is closed
+    int depth = block_depth(text);
+    char *more = NULL;
+    size_t more_cap = 0;
+    while (depth > 0) {
+        if (interactive) {
+            printf("> ");
+            fflush(stdout);
+        }
+        ssize_t n = getline(&more, &more_cap, in);
+        if (n < 0) {
+            free(more);
+            free(text);
+            return -1;
+        }
+        (*line)++;
+        // Here-document bodies are not part of the loop's statements
+        if (read_heredocs(more, in, line, interactive) < 0) {
+            free(more);
+            free(text);
+            return -1;
+        }
+        if (len + n + 2 > cap) {
+            cap = (len + n + 2) * 2;
+            char *grown = (char *)realloc(text, cap);
+            if (grown == NULL) {
+                free(more);
+                free(text);
+                return -1;
+            }
+            text = grown;
+        }
+        text[len++] = '\n';
+        memcpy(text + len, more, n + 1);
+        len += n;
+        depth += block_depth(more);
+    }
+    free(more);
+
+    char **stmts = NULL;
+    int stmts_cap = 0;
+    int count = split_statements(text, &stmts, 0, &stmts_cap);
+    free(text);
+    if (count < 0) {
+        return -1;
+    }
+
+    int pos = 0, error = 0;
+    ScriptNode *nodes = parse_list(stmts, count, &pos, 0, &error);
+    for (int i = 0; i < count; i++) {
+        free(stmts[i]);
+    }
+    free(stmts);
+
+    if (!error) {
+        run_nodes(nodes);
+    }
+    free_nodes(nodes);
+    return error ? -1 : 0;
+}
@@ -0,0 +1,35 @@
+//This is the header file for script.c
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdio.h>
+#include "heredoc.h"
+
+#define NODE_COMMAND 0
+#define NODE_FOR 1
+#define NODE_WHILE 2
+
+// ScriptNode structure:
+// One parsed statement. Loops are parsed once into a tree and their bodies
+// are then run as many times as needed without re-reading any input.
+typedef struct ScriptNode {
+    int type;                     // NODE_COMMAND, NODE_FOR or NODE_WHILE
+    char *text;                   // Command, loop condition, or word list of a for loop
+    char *var;                    // Loop variable of a for loop
+    HereDoc *docs;                // Bodies of the here-documents in text
+    struct ScriptNode *body;      // Loop body
+    struct ScriptNode *next;      // Next statement
+} ScriptNode;
+
+// ShellVar structure:
+// A shell variable set with name=value or by a for loop.
+typedef struct ShellVar {
+    char *name;
+    char *value;
+    struct ShellVar *next;
+} ShellVar;
+
+int run_script_line(char *input, FILE *in, int *line, int interactive);
+int changes_shell_state(const char *text);
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * trace.c
+ *
+ * Implements the GUSH_TRACE timeline. When the shell is started with
+ * GUSH_TRACE=file.json, every parse, find_executable, fork, child setup,
+ * execve, process lifetime and reap is recorded as a timestamped event and
+ * written out in the Chrome trace event format, which loads in chrome://tracing
+ * and Perfetto. Events are tagged with the line number and pipeline stage.
+ *
+ * Recording only copies a few fields into a ring buffer: the buffer lives in
+ * shared memory so forked children can record their own setup, and a writer
+ * thread in the shell formats and writes the events in the background. When
+ * the buffer is full new events are dropped (and counted) rather than blocking.
+ */
+
+#include "trace.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define TRACE_CAPACITY 65536          // Events held in the ring buffer
+#define TRACE_FLUSH_INTERVAL 5000     // Writer thread polling interval (microseconds)
+
+// TraceBuffer structure:
+// Ring buffer shared by the shell and its children.
+typedef struct TraceBuffer {
+    unsigned long long head;          // Next slot to reserve
+    unsigned long long tail;          // Next slot the writer thread will read
+    unsigned long long dropped;       // Events lost because the buffer was full
+    TraceEvent events[TRACE_CAPACITY];
+} TraceBuffer;
+
+static TraceBuffer *buffer = NULL;    // NULL when tracing is disabled
+static FILE *trace_file = NULL;
+static pthread_t writer;
+static int stop_writer = 0;
+static pid_t shell_pid = 0;
+static int current_line = 0;
+static int first_event = 1;
+
+/*
+ * trace_now - Returns the current time in nanoseconds, or 0 if tracing is off.
+ */
+long long trace_now() {
+    if (buffer == NULL) {
+        return 0;
+    }
+    return monotonic_ns();
+}
+
+/*
+ * trace_set_line - Sets the line number attached to the following events.
+ */
+void trace_set_line(int line) {
+    // Atomic, since helper threads (see prefetch.c) record events too
+    __atomic_store_n(&current_line, line, __ATOMIC_RELAXED);
+}
+
+/*
+ * record - Reserves a slot and stores one event. Never blocks.
+ */
+static void record(const char *name, long long start, long long dur, pid_t pid, int stage) {
+    unsigned long long slot = __atomic_load_n(&buffer->head, __ATOMIC_RELAXED);
+    do {
+        if (slot - __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE) >= TRACE_CAPACITY) {
+            __atomic_fetch_add(&buffer->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&buffer->head, &slot, slot + 1, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    TraceEvent *event = &buffer->events[slot % TRACE_CAPACITY];
+    event->name = name;
+    event->start = start;
+    event->dur = dur;
+    event->pid = pid;
+    event->line = __atomic_load_n(&current_line, __ATOMIC_RELAXED);
+    event->stage = stage;
+    __atomic_store_n(&event->seq, slot + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * trace_span - Records a span from start until now for process pid.
+ */
+void trace_span(const char *name, long long start, pid_t pid, int stage) {
+    if (buffer == NULL) {
+        return;
+    }
+    record(name, start, trace_now() - start, pid, stage);
+}
+
+/*
+ * trace_instant - Records a point in time for process pid.
+ */
+void trace_instant(const char *name, pid_t pid, int stage) {
+    if (buffer == NULL) {
+        return;
+    }
+    record(name, trace_now(), -1, pid, stage);
+}
+
+/*
+ * write_event - Formats one event as a Chrome trace JSON object.
+ */
+static void write_event(const TraceEvent *event) {
+    fprintf(trace_file, "%s\n{\"name\":\"%s\",\"cat\":\"gush\",\"ph\":\"%s\",\"ts\":%.3f,",
+            first_event ? "" : ",", event->name, event->dur < 0 ? "i" : "X",
+            event->start / 1000.0);
+    if (event->dur >= 0) {
+        fprintf(trace_file, "\"dur\":%.3f,", event->dur / 1000.0);
+    } else {
+        fprintf(trace_file, "\"s\":\"t\",");
+    }
+    fprintf(trace_file, "\"pid\":%d,\"tid\":%d,\"args\":{\"line\":%d,\"stage\":%d}}",
+            (int)shell_pid, event->pid, event->line, event->stage);
+    first_event = 0;
+}
+
+/*
+ * drain - Writes every completed event that has not been written yet.
+ */
+static void drain() {
+    unsigned long long tail = buffer->tail;
+    while (1) {
+        TraceEvent *event = &buffer->events[tail % TRACE_CAPACITY];
+        if (__atomic_load_n(&event->seq, __ATOMIC_ACQUIRE) != tail + 1) {
+            break;  // Not recorded yet (or still being written)
+        }
+        write_event(event);
+        tail++;
+        __atomic_store_n(&buffer->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * writer_thread - Flushes the ring buffer to the trace file in the background.
+ */
+static void *writer_thread(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&stop_writer, __ATOMIC_ACQUIRE)) {
+        drain();
+        usleep(TRACE_FLUSH_INTERVAL);
+    }
+    drain();
+    return NULL;
+}
+
+/*
+ * trace_finish - Stops the writer thread and completes the JSON file.
+ */
+static void trace_finish() {
+    __atomic_store_n(&stop_writer, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    fprintf(trace_file, "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"gush\"}}\n],\n\"otherData\":{\"dropped_events\":%llu}}\n",
+            first_event ? "" : ",", (int)shell_pid, buffer->dropped);
+    fclose(trace_file);
+    munmap(buffer, sizeof(TraceBuffer));
+    buffer = NULL;
+}
+
+/*
+ * trace_init - Enables tracing if GUSH_TRACE names an output file.
+ */
+void trace_init() {
+    const char *path = getenv("GUSH_TRACE");
+    if (path == NULL || *path == '\0') {
+        return;
+    }
+
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL) {
+        perror("GUSH_TRACE");
+        return;
+    }
+    fcntl(fileno(trace_file), F_SETFD, FD_CLOEXEC);  // Commands must not inherit it
+    TraceBuffer *shared = mmap(NULL, sizeof(TraceBuffer), PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("GUSH_TRACE");
+        fclose(trace_file);
+        return;
+    }
+
+    shell_pid = getpid();
+    fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    buffer = shared;
+    if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) {
+        perror("GUSH_TRACE");
+        munmap(buffer, sizeof(TraceBuffer));
+        buffer = NULL;
+        fclose(trace_file);
+        return;
+    }
+    atexit(trace_finish);
+}
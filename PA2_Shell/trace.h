@@ -0,0 +1,26 @@
+//This is the header file for trace.c
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <sys/types.h>
+
+// TraceEvent structure:
+// One recorded span (or instant event when dur is -1). Events are written into
+// a buffer shared with forked children, so child setup is traced as well.
+typedef struct TraceEvent {
+    unsigned long long seq;   // Slot index + 1, stored last once the event is complete
+    const char *name;         // Span name (a string literal)
+    long long start;          // Start time in nanoseconds (CLOCK_MONOTONIC)
+    long long dur;            // Duration in nanoseconds, -1 for an instant event
+    int pid;                  // Process the event belongs to
+    int line;                 // Batch (or interactive) line number
+    int stage;                // Pipeline stage or background job, -1 if none
+} TraceEvent;
+
+void trace_init();
+void trace_set_line(int line);
+long long trace_now();
+void trace_span(const char *name, long long start, pid_t pid, int stage);
+void trace_instant(const char *name, pid_t pid, int stage);
+
+#endif
@@ -6,11 +6,15 @@
  * such as printing error messages.
  */
 
+#include "utils.h"
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/wait.h>
+#include <time.h>
 
 #define ERROR_MSG "An error has occurred\n"
 
@@ -42,4 +46,47 @@ char *trim(char *str) {
         end--;
     }
     return str;
-}
\ No newline at end of file
+}
+
+/*
+ * exit_code - Converts a status from wait() into a shell exit code.
+ * A command killed by a signal reports 128 plus the signal number.
+ */
+int exit_code(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return 1;
+}
+
+/*
+ * write_all - Writes len bytes, retrying after partial writes.
+ * Returns 0 on success, or -1 on error.
+ */
+int write_all(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * monotonic_ns - Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ */
+long long monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
@@ -8,8 +8,13 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
+
 // Function to print a standard error message
 void print_error();
 char *trim(char *str);  
+int exit_code(int status);
+int write_all(int fd, const void *buf, size_t len);
+long long monotonic_ns();
 
 #endif